@@ -0,0 +1,15 @@
+#ifndef _DEQUE_H_
+#define _DEQUE_H_
+
+/*
+ * Chase-Lev work-stealing deque. The owner pushes and pops at the
+ * bottom, any other thread steals from the top.
+ */
+int deque_create(void **handle);
+int deque_delete(void *handle);
+int deque_push(void *handle, void *element);
+int deque_pop(void *handle, void **element);
+int deque_steal(void *handle, void **element);
+int deque_len(void *handle);
+
+#endif //_DEQUE_H_
\ No newline at end of file
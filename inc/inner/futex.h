@@ -0,0 +1,34 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Thin wrappers of the futex syscall for process private words. The
+ * result is not looked at, callers recheck the word in a loop anyway.
+ */
+
+/* Sleep as long as *addr holds val, may return early */
+static inline void futex_wait(int *addr, int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/* Like futex_wait, but gives up after ns */
+static inline void futex_wait_ns(int *addr, int val, long ns)
+{
+    struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+/* Wake up at most n sleepers on addr */
+static inline void futex_wake(int *addr, int n)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+#endif //_FUTEX_H_
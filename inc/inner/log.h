@@ -5,6 +5,16 @@
 #error Not define MODULE_NAME !!!
 #endif
 
+#include <stdlib.h>
+
+/*
+ * The most verbose level built in, 0 to 5. The macros of a level past it
+ * compile to nothing, their arguments are type checked but not evaluated.
+ */
+#ifndef LOG_BUILD_LEVEL
+#define LOG_BUILD_LEVEL (5)
+#endif
+
 #define LOG_CLR_NONE "\033[m"
 #define LOG_CLR_RED "\033[0;32;31m"
 #define LOG_CLR_GREEN "\033[0;32;32m"
@@ -23,62 +33,82 @@ typedef enum {
     LOG_LV_MAX
 } loglevel_t;
 
-#define debugf(fmt, ...)                                             \
-    do                                                               \
-    {                                                                \
-        log_printf(LOG_LV_DEBUG,                                     \
-                   LOG_CLR_NONE "[" MODULE_NAME "] "                 \
-                                "DEBUG (%s:%s|%d): " fmt,            \
-                   __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+/* Set by log_setlevel, checked before the arguments are evaluated */
+extern loglevel_t log_level;
+
+#define log_enabled(level) ((level) <= LOG_BUILD_LEVEL && (level) <= log_level)
+
+#define debugf(fmt, ...)                                                     \
+    do                                                                       \
+    {                                                                        \
+        if (log_enabled(LOG_LV_DEBUG)) {                                     \
+            log_printf(LOG_LV_DEBUG,                                         \
+                       LOG_CLR_NONE "[" MODULE_NAME "] "                     \
+                                    "DEBUG (%s:%s|%d): " fmt,                \
+                       __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__);     \
+        }                                                                    \
     } while (0)
 
-#define tracef(fmt, ...)                                             \
-    do                                                               \
-    {                                                                \
-        log_printf(LOG_LV_TRACE,                                     \
-                   LOG_CLR_CYAN "[" MODULE_NAME "] "                 \
-                                "TRACE (%s:%s|%d): " fmt,            \
-                   __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+#define tracef(fmt, ...)                                                     \
+    do                                                                       \
+    {                                                                        \
+        if (log_enabled(LOG_LV_TRACE)) {                                     \
+            log_printf(LOG_LV_TRACE,                                         \
+                       LOG_CLR_CYAN "[" MODULE_NAME "] "                     \
+                                    "TRACE (%s:%s|%d): " fmt,                \
+                       __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__);     \
+        }                                                                    \
     } while (0)
 
-#define infof(fmt, ...)                               \
-    do                                                \
-    {                                                 \
-        log_printf(LOG_LV_INFO,                       \
-                   LOG_CLR_GREEN "[" MODULE_NAME "] " \
-                                 "INFO : " fmt,       \
-                   ##__VA_ARGS__);                    \
+#define infof(fmt, ...)                                                      \
+    do                                                                       \
+    {                                                                        \
+        if (log_enabled(LOG_LV_INFO)) {                                      \
+            log_printf(LOG_LV_INFO,                                          \
+                       LOG_CLR_GREEN "[" MODULE_NAME "] "                    \
+                                     "INFO : " fmt,                          \
+                       ##__VA_ARGS__);                                       \
+        }                                                                    \
     } while (0)
 
-#define warnf(fmt, ...)                                \
-    do                                                 \
-    {                                                  \
-        log_printf(LOG_LV_WARN,                        \
-                   LOG_CLR_YELLOW "[" MODULE_NAME "] " \
-                                  "WARN : " fmt,       \
-                   ##__VA_ARGS__);                     \
+#define warnf(fmt, ...)                                                      \
+    do                                                                       \
+    {                                                                        \
+        if (log_enabled(LOG_LV_WARN)) {                                      \
+            log_printf(LOG_LV_WARN,                                          \
+                       LOG_CLR_YELLOW "[" MODULE_NAME "] "                   \
+                                      "WARN : " fmt,                         \
+                       ##__VA_ARGS__);                                       \
+        }                                                                    \
     } while (0)
 
-#define errorf(fmt, ...)                                             \
-    do                                                               \
-    {                                                                \
-        log_printf(LOG_LV_ERROR,                                     \
-                   LOG_CLR_RED "[" MODULE_NAME "] "                  \
-                               "ERROR (%s:%s|%d): " fmt,             \
-                   __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+#define errorf(fmt, ...)                                                     \
+    do                                                                       \
+    {                                                                        \
+        if (log_enabled(LOG_LV_ERROR)) {                                     \
+            log_printf(LOG_LV_ERROR,                                         \
+                       LOG_CLR_RED "[" MODULE_NAME "] "                      \
+                                   "ERROR (%s:%s|%d): " fmt,                 \
+                       __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__);     \
+        }                                                                    \
     } while (0)
 
-#define fatalf(fmt, ...)                                             \
-    do                                                               \
-    {                                                                \
-        log_printf(LOG_LV_ERROR,                                     \
-                   LOG_CLR_BLUE "[" MODULE_NAME "] "                 \
-                                "FATAL (%s:%s|%d): " fmt,            \
-                   __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
-        asset(0);                                                    \
+#define fatalf(fmt, ...)                                                     \
+    do                                                                       \
+    {                                                                        \
+        if (log_enabled(LOG_LV_FATAL)) {                                     \
+            log_printf(LOG_LV_FATAL,                                         \
+                       LOG_CLR_BLUE "[" MODULE_NAME "] "                     \
+                                    "FATAL (%s:%s|%d): " fmt,                \
+                       __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__);     \
+        }                                                                    \
+        log_flush();                                                         \
+        abort();                                                             \
     } while (0)
 
 int log_setlevel(loglevel_t level);
+int log_setasync(int async);
+int log_flush(void);
 int log_printf(loglevel_t level, const char *fmt, ...);
 
 #endif //_LOG_H_
\ No newline at end of file
@@ -3,7 +3,19 @@
 
 #include <stddef.h>
 
+typedef struct {
+    size_t alloc_hits;      /* allocations served by the thread cache */
+    size_t alloc_misses;    /* allocations that had to visit the depot */
+    size_t free_hits;       /* frees absorbed by the thread cache */
+    size_t free_misses;     /* frees that had to visit the depot */
+    size_t slab_bytes;      /* bytes currently mapped for slabs */
+    size_t slab_idle_bytes; /* bytes of fully free slabs kept for reuse */
+    size_t slab_releases;   /* slabs given back to the OS */
+} mem_stat_t;
+
 void *mem_alloc(size_t size);
 void mem_free(void *ptr);
+int mem_set_high_water(size_t bytes);
+int mem_get_stat(mem_stat_t *stat);
 
 #endif //_MEM_H_
\ No newline at end of file
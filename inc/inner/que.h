@@ -1,13 +1,45 @@
 #ifndef _QUE_H_
 #define _QUE_H_
 
+#include <stddef.h>
+
+#include "list.h"
+
+#define QUE_LEVEL_MAX (32)
+
+typedef enum {
+    QUE_TYPE_LIST = 0,      /* each element is wrapped in an allocated node */
+    QUE_TYPE_INTRUSIVE,     /* each element embeds its own que_link_t */
+    QUE_TYPE_RING,          /* bounded lock-free ring, FIFO only, a put to
+                               the head goes to an unbounded list in front */
+
+    QUE_TYPE_NONE,
+} que_type_e;
+
+typedef struct {
+    list_t list;
+    void *owner;            /* the queue holding the element, NULL if none */
+    int prio;               /* level of the element, higher is taken first */
+} que_link_t;
+
+typedef struct {
+    que_type_e type;
+    size_t offset;          /* offset of the que_link_t inside an element */
+    size_t capacity;        /* slots of a ring, rounded up to a power of 2 */
+    int levels;             /* priority levels of a list, 0 or 1 for FIFO only */
+    int aging;              /* every aging-th get serves a lower level, 0 never */
+} que_attr_t;
+
 int que_create(void **handle);
+int que_create_ex(const que_attr_t *attr, void **handle);
 int que_delete(void *handle);
 int que_put(void *handle, void *element);
 int que_put_to_head(void *handle, void *element);
+int que_put_batch(void *handle, void **elements, int n);
 int que_get(void *handle, void **element, int isblock);
-int que_peek(void *handle, void **element);
+int que_get_batch(void *handle, void **elements, int n, int isblock);
 int que_remove(void *handle, void *element);
 int que_len(void *handle);
+int que_level(void *handle);
 
 #endif //_QUE_H_
\ No newline at end of file
@@ -5,7 +5,7 @@
 
 typedef enum {
     TASK_TYPE_THREAD = 0,
-    TASK_TYPE_COROUTINE, //TODO
+    TASK_TYPE_COROUTINE,    /* multiplexed on a few carrier threads */
 
     TASK_TYPE_NONE,
 } task_type_e;
@@ -15,12 +15,18 @@ typedef struct {
 
     void *(*routine)(void *);
     void *arg;
+
+    size_t cpumask;         /* cpus the task is born on, 0 for all of them */
+    int policy;             /* sched policy the task is born with */
+    int priority;           /* sched priority the task is born with */
 } task_attr_t;
 
 int task_create(task_attr_t *attr, void **handle);
 int task_delete(void *handle);
-int task_set_affinity(void *handle, size_t cpumask);
-int task_set_schedpolicy(void *handle, int policy);
-int task_set_schedpriority(void *handle, int priority);
+int task_yield(int isidle);
+int task_in_coroutine(void);
+/* Coroutines only: sleep until task_unpark on word, unless *word != val */
+int task_park(int *word, int val);
+int task_unpark(int *word, int n);
 
 #endif //__TASK_H__
@@ -0,0 +1,39 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stddef.h>
+
+/*
+ * Event recorder with a ring per thread. Only its thread writes a ring,
+ * so recording takes no lock and shares no cache line. A full ring
+ * overwrites its oldest events. The rings are dumped as Chrome Trace
+ * Event JSON, which Perfetto and chrome://tracing open.
+ */
+
+typedef enum {
+    TRACE_EVENT_ENQUEUE = 0,    /* a job is queued */
+    TRACE_EVENT_START,          /* a job starts to run */
+    TRACE_EVENT_END,            /* a job returns */
+    TRACE_EVENT_STEAL,          /* a job is taken from the deque of slot arg */
+    TRACE_EVENT_PARK,           /* a worker sleeps until a job comes */
+    TRACE_EVENT_UNPARK,
+    /*
+     * Same on a coroutine worker. The coroutines of a carrier thread take
+     * turns, so these are async spans paired by id instead of nested ones:
+     * a job by itself, parked by the worker passed as job.
+     */
+    TRACE_EVENT_CORO_START,
+    TRACE_EVENT_CORO_END,
+    TRACE_EVENT_CORO_PARK,
+    TRACE_EVENT_CORO_UNPARK,
+
+    TRACE_EVENT_NONE,
+} trace_event_e;
+
+int trace_create(size_t events, void **handle);
+int trace_delete(void *handle);
+void trace_name(void *handle, const char *name);
+void trace_event(void *handle, trace_event_e type, const void *job, const void *func, int arg);
+int trace_dump(void *handle, const char *path);
+
+#endif //_TRACE_H_
@@ -0,0 +1,35 @@
+#ifndef _WHEEL_H_
+#define _WHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+
+/*
+ * Hierarchical timer wheel with its own thread. Insert and cancel are
+ * O(1), due elements are handed to the expire callback in batches.
+ */
+
+typedef struct {
+    list_t list;
+    void *owner;            /* the wheel holding the element, NULL if none */
+    uint64_t expire;        /* tick the element is due at */
+} wheel_link_t;
+
+typedef struct {
+    size_t offset;          /* offset of the wheel_link_t inside an element */
+    unsigned int tick_us;   /* resolution of the wheel, 0 for 1 ms */
+    /* called on the wheel thread with a batch of due elements */
+    void (*expire)(void *arg, void **elements, int n);
+    void *arg;
+} wheel_attr_t;
+
+uint64_t wheel_now(void);
+int wheel_create(const wheel_attr_t *attr, void **handle);
+int wheel_delete(void *handle);
+int wheel_add(void *handle, void *element, uint64_t expire_us);
+int wheel_flush(void *handle);
+int wheel_cancel(void *handle, void *element);
+
+#endif //_WHEEL_H_
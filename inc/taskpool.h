@@ -3,11 +3,16 @@
 
 #include <stddef.h>
 
+/* Queue priority levels of a job, 0 is the lowest */
+#define TASKPOOL_JOB_PRIORITY_NUM (8)
+/* Buckets of a time histogram of taskpool_stats_t */
+#define TASKPOOL_STATS_BUCKETS (40)
+
 typedef void *job_t;
 
 typedef enum {
     TASKPOOL_WORKER_TYPE_THREAD = 0,
-    TASKPOOL_WORKER_TYPE_COROUTINE, //TODO
+    TASKPOOL_WORKER_TYPE_COROUTINE, /* multiplexed on a few carrier threads */
     TASKPOOL_WORKER_TYPE_NONE,
 } taskpool_worker_type_e;
 
@@ -15,11 +20,73 @@ typedef enum {
     TASKPOOL_JOB_STATUS_TODO = 0,
     TASKPOOL_JOB_STATUS_DOING,
     TASKPOOL_JOB_STATUS_DONE,
+    TASKPOOL_JOB_STATUS_CANCELED,   /* never ran, taken down by deinit */
     TASKPOOL_JOB_STATUS_NONE,
 } taskpool_job_status_e;
 
+typedef enum {
+    TASKPOOL_QUEUE_TYPE_LIST = 0,   /* unbounded list guarded by a mutex */
+    TASKPOOL_QUEUE_TYPE_RING,       /* bounded lock-free ring, FIFO only */
+    TASKPOOL_QUEUE_TYPE_NONE,
+} taskpool_queue_type_e;
+
+typedef enum {
+    TASKPOOL_SCHED_TYPE_SHARED = 0, /* all workers take jobs from one queue */
+    TASKPOOL_SCHED_TYPE_STEAL,      /* per-worker deques with work stealing */
+    TASKPOOL_SCHED_TYPE_NONE,
+} taskpool_sched_type_e;
+
+typedef enum {
+    TASKPOOL_DRAIN_TYPE_FINISH = 0, /* deinit runs every job added before,
+                                       a timed one at once and only once */
+    TASKPOOL_DRAIN_TYPE_CANCEL,     /* deinit cancels the jobs not started yet */
+    TASKPOOL_DRAIN_TYPE_NONE,
+} taskpool_drain_type_e;
+
+typedef struct {
+    taskpool_queue_type_e queue_type;   /* backend of the pending job queue. A ring
+                                           is FIFO only: it ignores the priority of
+                                           a job and priority_aging, and add_job
+                                           fails while it is full */
+    size_t queue_capacity;              /* max pending jobs of a ring, 0 for default */
+    taskpool_sched_type_e sched_type;   /* how workers find their next job */
+    int priority_aging;                 /* every n-th job comes from a lower
+                                           priority level, 0 for strict order */
+    /* An idle thread worker spins, then yields, then parks */
+    int idle_spin;                      /* pause rounds, 0 for none */
+    int idle_yield;                     /* sched_yield rounds, 0 for none */
+    int idle_spinners;                  /* max workers spinning or yielding at
+                                           once, 0 for half the cpus */
+    taskpool_drain_type_e drain_type;   /* what deinit does with pending jobs */
+    int timing;                         /* time the jobs for the busy time and
+                                           histograms of get_stats, a clock
+                                           read when queued, started, done */
+    size_t trace_events;                /* events each thread keeps for
+                                           dump_trace, 0 for no tracing */
+    size_t mem_high_water;              /* bytes of free slabs the allocator keeps
+                                           for reuse before unmapping, shared by
+                                           all pools, 0 to leave it as it is */
+} taskpool_attr_t;
+
+typedef struct {
+    const char *name;           /* unique name the workers refer to */
+    taskpool_worker_type_e type;
+
+    size_t sys_cpu_mask;        /* the workers run on which cpus, 0 for all */
+    int sys_sched_policy;       /* the scheduling policy of the workers */
+    int sys_sched_priority;     /* the scheduling priority of the workers */
+
+    /* Autoscaling between min and max workers, off when max_workers is 0 */
+    int min_workers;            /* started with the group, never retired */
+    int max_workers;
+    int scale_depth;            /* grow past this many pending jobs per worker */
+    int scale_wait_ms;          /* or once jobs have waited this long, 0 for never */
+    int idle_timeout_ms;        /* retire a worker idle this long, 0 for never */
+} taskpool_group_attr_t;
+
 typedef struct {
     taskpool_worker_type_e type;
+    const char *group;          /* the group to join, NULL for the default one of type */
 } taskpool_worker_attr_t;
 
 typedef struct {
@@ -28,6 +95,8 @@ typedef struct {
     size_t sys_cpu_mask;        /* this job can run on which cpus */
     int sys_sched_policy;       /* the scheduling policy for this job */
     int sys_sched_priority;     /* the scheduling priority for this job */
+    int priority;               /* queue priority, 0 ~ TASKPOOL_JOB_PRIORITY_NUM - 1,
+                                   higher ones are taken first (list queue only) */
 
     int (*func)(void *);        /* pointer to the function to do */
     void *arg;                  /* pointer to an argument */
@@ -38,18 +107,54 @@ typedef struct {
     int errno;
 } taskpool_job_status_t;
 
+typedef struct {
+    const char *group;          /* name of the group of the worker */
+    size_t runs;                /* jobs run, every run of a periodic one counts */
+    size_t failed;              /* runs whose func returned non-zero */
+    size_t busy_ns;             /* time spent in func, attr.timing only */
+} taskpool_worker_stats_t;
+
+typedef struct {
+    size_t queue_depth;         /* jobs queued, not taken by a worker yet */
+    size_t pending;             /* jobs added and not yet done or deleted */
+    size_t submitted;           /* jobs added so far */
+    size_t completed;           /* jobs done */
+    size_t failed;              /* runs whose func returned non-zero */
+    size_t cancelled;           /* jobs deleted or drained before they ran */
+    /* Bucket i counts the jobs that took [2^i, 2^(i+1)) ns, attr.timing only */
+    size_t wait_ns[TASKPOOL_STATS_BUCKETS];     /* from queued to started */
+    size_t run_ns[TASKPOOL_STATS_BUCKETS];      /* from started to done */
+    size_t n_workers;           /* workers running now */
+    taskpool_worker_stats_t *workers;   /* set by the caller, gets up to
+                                           max_workers of them, may be NULL */
+    size_t max_workers;
+} taskpool_stats_t;
+
 typedef struct taskpool {
     /* Private date */
     void *priv;
 
     /**
-     * @brief  Destory taskpool instance
+     * @brief  Destory taskpool instance, once the pending jobs are done or
+     *         cancelled as drain_type says and every worker has exited
      *
      * @param  self     taskpool instance
      * @return 0 on successs, -1 otherwise.
      */
     int (*deinit)(struct taskpool *self);
 
+    /**
+     * @brief Add a group of workers configured once with the given cpu mask,
+     *        sched policy and priority. Jobs whose sys_* attributes match
+     *        these go to the group's workers, the rest go to the default
+     *        group of their type, which runs with the system defaults.
+     *
+     * @param  self     taskpool instance
+     * @param  attr     the attribute of group wanted to be created
+     * @return 0 on successs, -1 otherwise.
+     */
+    int (*add_group)(struct taskpool *self, const taskpool_group_attr_t *attr);
+
     /**
      * @brief Add one kind of worker
      *
@@ -77,7 +182,60 @@ typedef struct taskpool {
      */
     int (*add_job)(struct taskpool *self, const taskpool_job_attr_t *attr, job_t *job);
     /**
-     * @brief Delete job
+     * @brief Add jobs in one batch
+     *
+     * @param  self     taskpool instance
+     * @param  attrs    the attributes of the n jobs wanted to be created
+     * @param  n        number of jobs
+     * @param  jobs     return the n jobs' handles if user requests,
+     *                  NULL for the jobs that could not be added
+     * @return 0 on successs, -1 otherwise.
+     */
+    int (*add_jobs)(struct taskpool *self, const taskpool_job_attr_t *attrs, size_t n, job_t *jobs);
+    /**
+     * @brief Add job that starts once all of its predecessors are done,
+     *        the worker finishing the last one dispatches it. A deleted
+     *        predecessor that never ran does not hold it back either.
+     *
+     * @param  self     taskpool instance
+     * @param  attr     the attribute of job wanted to be created
+     * @param  deps     handles of the predecessors, none may be stale
+     * @param  n_deps   number of predecessors
+     * @param  job      return the job's handle if user requests
+     * @return 0 on successs, -1 otherwise.
+     */
+    int (*add_job_after)(struct taskpool *self, const taskpool_job_attr_t *attr,
+                         const job_t *deps, size_t n_deps, job_t *job);
+    /**
+     * @brief Add job as a continuation of another one
+     *
+     * @param  self     taskpool instance
+     * @param  job      the job to continue, its handle must stay valid
+     * @param  attr     the attribute of the continuation
+     * @param  next     return the continuation's handle if user requests
+     * @return 0 on successs, -1 otherwise.
+     */
+    int (*then)(struct taskpool *self, job_t job, const taskpool_job_attr_t *attr, job_t *next);
+    /**
+     * @brief Add job that starts after a delay, and again every period.
+     *        A periodic job runs until it is deleted. deinit does not wait
+     *        for the due time, it runs a timed job one last time at once,
+     *        or cancels it as drain_type says. It counts as not done until
+     *        then.
+     *
+     * @param  self     taskpool instance
+     * @param  attr     the attribute of job wanted to be created
+     * @param  delay_ms milliseconds before the first run
+     * @param  period_ms milliseconds between two starts, 0 to run once
+     * @param  job      return the job's handle if user requests
+     * @return 0 on successs, -1 otherwise.
+     */
+    int (*add_timed_job)(struct taskpool *self, const taskpool_job_attr_t *attr,
+                         size_t delay_ms, size_t period_ms, job_t *job);
+    /**
+     * @brief Delete job, a job not started yet is cancelled and never runs.
+     *        The handle goes stale, using it again fails with -1. Handles
+     *        not deleted are freed by deinit.
      *
      * @param  self     taskpool instance
      * @param  job      job's handle
@@ -101,6 +259,41 @@ typedef struct taskpool {
      */
     int (*wait_all_jobs_done)(struct taskpool *self);
 
+    /**
+     * @brief Run func over [begin, end) split in pieces, which the workers
+     *        and the caller run side by side. Returns once all are done.
+     *
+     * @param  self     taskpool instance
+     * @param  begin    first index of the range
+     * @param  end      one past the last index of the range
+     * @param  grain    max indexes of a piece, 0 to pick one from the workers
+     * @param  func     called once for each piece [begin, end)
+     * @param  ctx      passed to func
+     * @return 0 on successs, -1 otherwise.
+     */
+    int (*parallel_for)(struct taskpool *self, size_t begin, size_t end, size_t grain,
+                        void (*func)(size_t begin, size_t end, void *ctx), void *ctx);
+    /**
+     * @brief Like parallel_for, but each piece folds its indexes into a
+     *        value of its own, started from a copy of *result. Then join
+     *        merges the values of neighbouring pieces left to right.
+     *
+     * @param  self     taskpool instance
+     * @param  begin    first index of the range
+     * @param  end      one past the last index of the range
+     * @param  grain    max indexes of a piece, 0 to pick one from the workers
+     * @param  result   holds the identity of join, returns the reduced value
+     * @param  size     bytes of a value
+     * @param  func     folds the piece [begin, end) into value
+     * @param  join     folds other, the value of the next piece, into value
+     * @param  ctx      passed to func and join
+     * @return 0 on successs, -1 otherwise.
+     */
+    int (*parallel_reduce)(struct taskpool *self, size_t begin, size_t end, size_t grain,
+                           void *result, size_t size,
+                           void (*func)(size_t begin, size_t end, void *value, void *ctx),
+                           void (*join)(void *value, const void *other, void *ctx), void *ctx);
+
     /**
      * @brief Get the specified job status
      *
@@ -111,6 +304,27 @@ typedef struct taskpool {
      */
     int (*get_job_status)(struct taskpool *self, job_t job, taskpool_job_status_t *status);
 
+    /**
+     * @brief Get a snapshot of the counters of the pool and its workers.
+     *        Each worker keeps its own, so the jobs never share a counter.
+     *
+     * @param  self     taskpool instance
+     * @param  stats    return the counters, workers and max_workers are read
+     * @return 0 on successs, -1 otherwise.
+     */
+    int (*get_stats)(struct taskpool *self, taskpool_stats_t *stats);
+
+    /**
+     * @brief Write the latest events of every thread as Chrome Trace Event
+     *        JSON, to be opened by Perfetto or chrome://tracing. Only a pool
+     *        created with trace_events records them.
+     *
+     * @param  self     taskpool instance
+     * @param  path     file to write
+     * @return 0 on successs, -1 otherwise.
+     */
+    int (*dump_trace)(struct taskpool *self, const char *path);
+
 } taskpool_t;
 
 /**
@@ -122,4 +336,34 @@ typedef struct taskpool {
  */
 taskpool_t *taskpool_init();
 
+/**
+ * @brief  Create taskpool instance with the given attribute
+ *
+ * @param  attr         the attribute of taskpool, NULL for default
+ * @return taskpool     created instance on success,
+ *                      NULL on error
+ */
+taskpool_t *taskpool_init_ex(const taskpool_attr_t *attr);
+
+/**
+ * @brief  Yield the cpu from inside a job. On a coroutine worker the other
+ *         coroutines of the same carrier thread run meanwhile, so a job
+ *         polling for I/O should call it rather than block.
+ *
+ * @param
+ * @return 0 on successs, -1 otherwise.
+ */
+int taskpool_yield(void);
+
+/**
+ * @brief  Switch the log of the library to a background flusher. A worker
+ *         then only formats a line into a buffer of its own thread and never
+ *         waits on stdout. A trace, debug or info line that finds the buffer
+ *         full is dropped and counted, a warning or worse is written at once.
+ *
+ * @param  async        1 to switch on, 0 to write out the rest and switch off
+ * @return 0 on successs, -1 otherwise.
+ */
+int taskpool_log_async(int async);
+
 #endif //__TASKPOOL_H__
@@ -0,0 +1,215 @@
+#include "deque.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "mem.h"
+
+#define DEQUE_INIT_SIZE (64)
+#define DEQUE_CACHELINE (64)
+
+typedef struct __array {
+    struct __array *prev;
+    long size;
+    void *buf[0];
+} deque_array_t;
+
+typedef struct {
+    long top;
+    char pad0[DEQUE_CACHELINE - sizeof(long)];
+    long bottom;
+    char pad1[DEQUE_CACHELINE - sizeof(long)];
+    deque_array_t *array;
+} deque_priv_t;
+
+static deque_array_t *__array_new(long size)
+{
+    deque_array_t *array = mem_alloc(sizeof(deque_array_t) + size * sizeof(void *));
+    if (array == NULL) {
+        errorf("mem_alloc err\n");
+        return NULL;
+    }
+
+    array->prev = NULL;
+    array->size = size;
+    return array;
+}
+
+static deque_array_t *__array_grow(deque_array_t *old, long top, long bottom)
+{
+    long i;
+    deque_array_t *array = __array_new(old->size * 2);
+    if (array == NULL) {
+        return NULL;
+    }
+
+    for (i = top; i < bottom; i++) {
+        array->buf[i & (array->size - 1)] =
+            __atomic_load_n(&old->buf[i & (old->size - 1)], __ATOMIC_RELAXED);
+    }
+
+    /* Thieves may still read the old array, keep it until deque_delete */
+    array->prev = old;
+    return array;
+}
+
+int deque_create(void **handle)
+{
+    deque_priv_t *pPriv = NULL;
+
+    if (handle == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    pPriv = (deque_priv_t *)mem_alloc(sizeof(deque_priv_t));
+    if (pPriv == NULL) {
+        errorf("mem_alloc err\n");
+        return -1;
+    }
+
+    memset(pPriv, 0, sizeof(deque_priv_t));
+    pPriv->array = __array_new(DEQUE_INIT_SIZE);
+    if (pPriv->array == NULL) {
+        mem_free(pPriv);
+        return -1;
+    }
+
+    *handle = pPriv;
+    return 0;
+}
+
+int deque_delete(void *handle)
+{
+    deque_priv_t *pPriv = (deque_priv_t *)handle;
+    deque_array_t *array, *tmp;
+
+    if (pPriv == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    array = pPriv->array;
+    while (array) {
+        tmp = array;
+        array = array->prev;
+        mem_free(tmp);
+    }
+    mem_free(pPriv);
+
+    return 0;
+}
+
+int deque_push(void *handle, void *element)
+{
+    long top, bottom;
+    deque_priv_t *pPriv = (deque_priv_t *)handle;
+    deque_array_t *array = NULL;
+
+    if (pPriv == NULL || element == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    bottom = __atomic_load_n(&pPriv->bottom, __ATOMIC_RELAXED);
+    top = __atomic_load_n(&pPriv->top, __ATOMIC_ACQUIRE);
+    array = __atomic_load_n(&pPriv->array, __ATOMIC_RELAXED);
+    if (bottom - top > array->size - 1) {
+        array = __array_grow(array, top, bottom);
+        if (array == NULL) {
+            errorf("__array_grow err\n");
+            return -1;
+        }
+        __atomic_store_n(&pPriv->array, array, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&array->buf[bottom & (array->size - 1)], element, __ATOMIC_RELAXED);
+    __atomic_store_n(&pPriv->bottom, bottom + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int deque_pop(void *handle, void **element)
+{
+    int status = 0;
+    long top, bottom;
+    deque_priv_t *pPriv = (deque_priv_t *)handle;
+    deque_array_t *array = NULL;
+
+    if (pPriv == NULL || element == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    bottom = __atomic_load_n(&pPriv->bottom, __ATOMIC_RELAXED) - 1;
+    array = __atomic_load_n(&pPriv->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&pPriv->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&pPriv->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        /* Empty */
+        __atomic_store_n(&pPriv->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    *element = __atomic_load_n(&array->buf[bottom & (array->size - 1)], __ATOMIC_RELAXED);
+    if (top == bottom) {
+        /* Last element, race the thieves for it */
+        if (!__atomic_compare_exchange_n(&pPriv->top, &top, top + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            status = -1;
+        }
+        __atomic_store_n(&pPriv->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+
+    return status;
+}
+
+int deque_steal(void *handle, void **element)
+{
+    long top, bottom;
+    void *tmp = NULL;
+    deque_priv_t *pPriv = (deque_priv_t *)handle;
+    deque_array_t *array = NULL;
+
+    if (pPriv == NULL || element == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    top = __atomic_load_n(&pPriv->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&pPriv->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return -1;
+    }
+
+    array = __atomic_load_n(&pPriv->array, __ATOMIC_ACQUIRE);
+    tmp = __atomic_load_n(&array->buf[top & (array->size - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&pPriv->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        /* Lost the race against the owner or another thief */
+        return -1;
+    }
+
+    *element = tmp;
+    return 0;
+}
+
+int deque_len(void *handle)
+{
+    long len;
+    deque_priv_t *pPriv = (deque_priv_t *)handle;
+
+    if (pPriv == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    len = __atomic_load_n(&pPriv->bottom, __ATOMIC_RELAXED) -
+          __atomic_load_n(&pPriv->top, __ATOMIC_RELAXED);
+
+    return len < 0 ? 0 : len;
+}
\ No newline at end of file
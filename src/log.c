@@ -1,9 +1,160 @@
 #include "log.h"
 
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-static loglevel_t s_level = LOG_LV_INFO;
+#include "futex.h"
+
+#define LOG_LINE_MAX (512)          /* longer lines are cut in async mode */
+#define LOG_BUF_SIZE (65536)        /* bytes a thread may have not written out */
+#define LOG_FLUSH_NS (10000000)     /* the flusher looks at least this often */
+
+/* Bytes of one thread, put by it alone and written out by the flusher */
+typedef struct log_buf {
+    struct log_buf *next;
+    int used;                   /* owned by a running thread */
+    size_t head;                /* bytes put so far */
+    size_t tail;                /* bytes written out so far, under s_flush_lock */
+    size_t dropped;             /* lines that found it full */
+    char data[LOG_BUF_SIZE];
+} log_buf_t;
+
+loglevel_t log_level = LOG_LV_INFO;
+
+static int s_async;
+static int s_stop;
+static int s_kick;                  /* futex word, bumped to wake the flusher */
+static pthread_t s_flusher;
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t s_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_key;
+/* Only ever pushed to, a buffer left by an exited thread goes to the next */
+static log_buf_t *s_bufs;
+static __thread log_buf_t *s_buf;
+
+static void __buf_release(void *arg)
+{
+    __atomic_store_n(&((log_buf_t *)arg)->used, 0, __ATOMIC_RELEASE);
+}
+
+static void __log_exit(void)
+{
+    log_flush();
+}
+
+static void __log_once(void)
+{
+    pthread_key_create(&s_key, __buf_release);
+    atexit(__log_exit);
+}
+
+static log_buf_t *__buf_get(void)
+{
+    int used;
+    log_buf_t *buf = s_buf;
+
+    if (buf) {
+        return buf;
+    }
+
+    for (buf = __atomic_load_n(&s_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        used = 0;
+        if (__atomic_compare_exchange_n(&buf->used, &used, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (buf == NULL) {
+        buf = (log_buf_t *)malloc(sizeof(log_buf_t));
+        if (buf == NULL) {
+            return NULL;
+        }
+        buf->used = 1;
+        buf->head = 0;
+        buf->tail = 0;
+        buf->dropped = 0;
+        buf->next = __atomic_load_n(&s_bufs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&s_bufs, &buf->next, buf, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    pthread_setspecific(s_key, buf);
+    s_buf = buf;
+    return buf;
+}
+
+static int __buf_put(log_buf_t *buf, loglevel_t level, const char *line, size_t n)
+{
+    size_t off, first, used;
+
+    used = buf->head - __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE);
+    if (n > LOG_BUF_SIZE - used) {
+        /* A warning or worse is never lost, it goes out at once instead */
+        if (level <= LOG_LV_WARN) {
+            return fwrite(line, 1, n, stdout) == n ? 0 : -1;
+        }
+        __atomic_add_fetch(&buf->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    off = buf->head % LOG_BUF_SIZE;
+    first = n < LOG_BUF_SIZE - off ? n : LOG_BUF_SIZE - off;
+    memcpy(buf->data + off, line, first);
+    memcpy(buf->data, line + first, n - first);
+    __atomic_store_n(&buf->head, buf->head + n, __ATOMIC_RELEASE);
+
+    /* Otherwise the flusher comes by itself in a while */
+    if (used + n > LOG_BUF_SIZE / 2 || level <= LOG_LV_ERROR) {
+        __atomic_add_fetch(&s_kick, 1, __ATOMIC_RELEASE);
+        futex_wake(&s_kick, 1);
+    }
+    /* Past half full, let the flusher have a cpu before it overflows */
+    if (used + n > LOG_BUF_SIZE / 2) {
+        sched_yield();
+    }
+
+    return 0;
+}
+
+/* Under s_flush_lock */
+static void __buf_drain(log_buf_t *buf)
+{
+    size_t n, off, dropped;
+    size_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+    size_t tail = buf->tail;
+
+    while (tail != head) {
+        off = tail % LOG_BUF_SIZE;
+        n = head - tail < LOG_BUF_SIZE - off ? head - tail : LOG_BUF_SIZE - off;
+        fwrite(buf->data + off, 1, n, stdout);
+        tail += n;
+    }
+    __atomic_store_n(&buf->tail, tail, __ATOMIC_RELEASE);
+
+    dropped = __atomic_exchange_n(&buf->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        printf(LOG_CLR_YELLOW "[log] WARN : %zu lines dropped\n", dropped);
+    }
+}
+
+static void *__flusher(void *arg)
+{
+    int kick;
+
+    while (!__atomic_load_n(&s_stop, __ATOMIC_ACQUIRE)) {
+        kick = __atomic_load_n(&s_kick, __ATOMIC_ACQUIRE);
+        log_flush();
+        futex_wait_ns(&s_kick, kick, LOG_FLUSH_NS);
+    }
+
+    return NULL;
+}
 
 int log_setlevel(loglevel_t level)
 {
@@ -11,7 +162,47 @@ int log_setlevel(loglevel_t level)
         return -1;
     }
 
-    s_level = level;
+    log_level = level;
+    return 0;
+}
+
+int log_setasync(int async)
+{
+    int status = 0;
+
+    pthread_mutex_lock(&s_lock);
+    if (async && !s_async) {
+        pthread_once(&s_once, __log_once);
+        s_stop = 0;
+        status = pthread_create(&s_flusher, NULL, __flusher, NULL);
+        if (status == 0) {
+            __atomic_store_n(&s_async, 1, __ATOMIC_RELEASE);
+        }
+    } else if (!async && s_async) {
+        /* A line put meanwhile waits for the next flush */
+        __atomic_store_n(&s_async, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&s_stop, 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&s_kick, 1, __ATOMIC_RELEASE);
+        futex_wake(&s_kick, 1);
+        pthread_join(s_flusher, NULL);
+        log_flush();
+    }
+    pthread_mutex_unlock(&s_lock);
+
+    return status ? -1 : 0;
+}
+
+int log_flush(void)
+{
+    log_buf_t *buf = NULL;
+
+    pthread_mutex_lock(&s_flush_lock);
+    for (buf = __atomic_load_n(&s_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        __buf_drain(buf);
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&s_flush_lock);
+
     return 0;
 }
 
@@ -19,14 +210,25 @@ int log_printf(loglevel_t level, const char *fmt, ...)
 {
     int n;
     va_list ap;
+    char line[LOG_LINE_MAX];
+    log_buf_t *buf = NULL;
 
-    if (level > s_level) {
+    if (level > log_level) {
         return 0;
     }
 
     va_start(ap, fmt);
-    n = vprintf(fmt, ap);
+    if (__atomic_load_n(&s_async, __ATOMIC_ACQUIRE) && (buf = __buf_get())) {
+        /* Formatted here, the flusher only copies bytes to stdout */
+        n = vsnprintf(line, sizeof(line), fmt, ap);
+        n = n < 0 ? 0 : (n < sizeof(line) ? n : sizeof(line) - 1);
+        if (__buf_put(buf, level, line, n)) {
+            n = 0;
+        }
+    } else {
+        n = vprintf(fmt, ap);
+    }
     va_end(ap);
 
     return n;
-}
\ No newline at end of file
+}
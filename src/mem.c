@@ -1,9 +1,13 @@
 #include "mem.h"
 
+#include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
+#include "list.h"
 #include "log.h"
 
 #define ENTRY(ptr, type, member) \
@@ -32,22 +36,87 @@ typedef struct __obj {
 } mem_obj_t;
 
 #define POW2(N) (1 << (N))
-#define MEM_LIST_NUM (8)
+#define MEM_LIST_NUM (13)
 #define MEM_MAX_BYTES (POW2(MEM_LIST_NUM - 1))
+#define MEM_MAG_SIZE (32)
+#define MEM_MAG_BYTES (16 * 1024)
+#define MEM_DEPOT_MAX (8)
+#define MEM_SLAB_SIZE (64 * 1024)
+#define MEM_SLAB_MAGIC (0x51ab51ab)
+#define MEM_HIGH_WATER (16 * MEM_SLAB_SIZE)
+
+/*
+ * Every size class is served in three layers:
+ *   - a per-thread cache holding two magazines (loaded and previous),
+ *     touched without any lock;
+ *   - a per-class depot of full and empty magazines, exchanged with the
+ *     thread cache one whole magazine at a time under the depot lock;
+ *   - slabs, MEM_SLAB_SIZE aligned chunks from mmap carved into blocks of
+ *     one class, used to fill magazines and to take back the rounds of
+ *     magazines the depot has no room for. Fully free slabs are kept for
+ *     reuse up to the high-water mark and unmapped beyond it.
+ */
+typedef struct __mag {
+    struct __mag *next;
+    size_t rounds;
+    mem_obj_t *round[MEM_MAG_SIZE];
+} mem_mag_t;
+
+typedef struct {
+    list_t list;
+    size_t magic;
+    size_t index;
+    size_t total;
+    size_t inuse;
+    mem_obj_t *free;
+} mem_slab_t;
 
 typedef struct {
     pthread_mutex_t lock;
+    size_t size;
+    size_t mag_size;
+    size_t n_full;
+    size_t n_empty;
+    mem_mag_t *full;
+    mem_mag_t *empty;
+    list_t partial;
+    list_t used;
+    list_t idle;
+} mem_depot_t;
+
+typedef struct {
+    mem_mag_t *loaded;
+    mem_mag_t *previous;
+} mem_cache_t;
+
+typedef struct {
+    int inited;
+    mem_cache_t cache[MEM_LIST_NUM];
+    mem_stat_t stat;
+} mem_tls_t;
+
+typedef struct {
+    pthread_once_t once;
+    pthread_key_t key;
     size_t max_bytes;
     size_t num;
-    mem_obj_t *array[MEM_LIST_NUM];
+    size_t high_water;
+    mem_depot_t depot[MEM_LIST_NUM];
+    mem_stat_t stat;
 } mem_info_t;
 
 static mem_info_t s_mem_info = {
-    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
     .num = MEM_LIST_NUM,
     .max_bytes = MEM_MAX_BYTES,
+    .high_water = MEM_HIGH_WATER,
+    .depot = {
+        [0 ... MEM_LIST_NUM - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+    },
 };
 
+static __thread mem_tls_t s_mem_tls;
+
 static size_t __get_block_size(size_t size)
 {
     size_t i = MEM_LIST_NUM;
@@ -72,10 +141,370 @@ static size_t __get_array_index(size_t size)
     return i;
 }
 
+static void __stat_fold(mem_tls_t *tls)
+{
+    mem_info_t *info = &s_mem_info;
+
+    __atomic_fetch_add(&info->stat.alloc_hits, tls->stat.alloc_hits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&info->stat.alloc_misses, tls->stat.alloc_misses, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&info->stat.free_hits, tls->stat.free_hits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&info->stat.free_misses, tls->stat.free_misses, __ATOMIC_RELAXED);
+    memset(&tls->stat, 0, sizeof(mem_stat_t));
+}
+
+static mem_slab_t *__slab_new(mem_depot_t *depot, size_t index)
+{
+    size_t i, stride;
+    char *base, *aligned;
+    mem_slab_t *slab = NULL;
+    mem_obj_t *obj = NULL;
+
+    /* Over-map and trim so the slab is found by masking a block address */
+    base = mmap(NULL, 2 * MEM_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        errorf("mmap err\n");
+        return NULL;
+    }
+
+    aligned = ROUNDUP(base, MEM_SLAB_SIZE);
+    if (aligned != base) {
+        munmap(base, aligned - base);
+    }
+    munmap(aligned + MEM_SLAB_SIZE, base + MEM_SLAB_SIZE - aligned);
+
+    slab = (mem_slab_t *)aligned;
+    slab->magic = MEM_SLAB_MAGIC;
+    slab->index = index;
+    slab->inuse = 0;
+    slab->free = NULL;
+
+    stride = ROUNDUP(sizeof(mem_obj_t) + depot->size, sizeof(void *));
+    slab->total = (MEM_SLAB_SIZE - sizeof(mem_slab_t)) / stride;
+    for (i = slab->total; i > 0; i--) {
+        obj = (mem_obj_t *)(aligned + sizeof(mem_slab_t) + (i - 1) * stride);
+        obj->header.next = slab->free;
+        slab->free = obj;
+    }
+
+    __atomic_fetch_add(&s_mem_info.stat.slab_bytes, MEM_SLAB_SIZE, __ATOMIC_RELAXED);
+    return slab;
+}
+
+static void __slab_delete(mem_slab_t *slab)
+{
+    munmap(slab, MEM_SLAB_SIZE);
+    __atomic_fetch_sub(&s_mem_info.stat.slab_bytes, MEM_SLAB_SIZE, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_mem_info.stat.slab_releases, 1, __ATOMIC_RELAXED);
+}
+
+/* Called with depot->lock held */
+static void __slab_retire(mem_slab_t *slab)
+{
+    mem_info_t *info = &s_mem_info;
+    mem_depot_t *depot = &info->depot[slab->index];
+    size_t idle = __atomic_add_fetch(&info->stat.slab_idle_bytes, MEM_SLAB_SIZE, __ATOMIC_RELAXED);
+
+    if (idle > __atomic_load_n(&info->high_water, __ATOMIC_RELAXED)) {
+        __atomic_fetch_sub(&info->stat.slab_idle_bytes, MEM_SLAB_SIZE, __ATOMIC_RELAXED);
+        __slab_delete(slab);
+        return;
+    }
+
+    list_add(&slab->list, &depot->idle);
+}
+
+/* Called with depot->lock held */
+static mem_obj_t *__slab_get(mem_depot_t *depot, size_t index)
+{
+    mem_slab_t *slab = NULL;
+    mem_obj_t *obj = NULL;
+
+    if (!list_empty(&depot->partial)) {
+        slab = list_entry(depot->partial.next, mem_slab_t, list);
+    } else if (!list_empty(&depot->idle)) {
+        slab = list_entry(depot->idle.next, mem_slab_t, list);
+        list_del(&slab->list);
+        list_add(&slab->list, &depot->partial);
+        __atomic_fetch_sub(&s_mem_info.stat.slab_idle_bytes, MEM_SLAB_SIZE, __ATOMIC_RELAXED);
+    } else {
+        slab = __slab_new(depot, index);
+        if (slab == NULL) {
+            return NULL;
+        }
+        list_add(&slab->list, &depot->partial);
+    }
+
+    obj = slab->free;
+    slab->free = obj->header.next;
+    if (++slab->inuse == slab->total) {
+        list_del(&slab->list);
+        list_add(&slab->list, &depot->used);
+    }
+
+    return obj;
+}
+
+/* Called with depot->lock held */
+static void __slab_put(mem_depot_t *depot, mem_obj_t *obj)
+{
+    mem_slab_t *slab = ROUNDDOWN((mem_slab_t *)obj, MEM_SLAB_SIZE);
+
+    assert(slab->magic == MEM_SLAB_MAGIC);
+    obj->header.next = slab->free;
+    slab->free = obj;
+
+    if (--slab->inuse == 0) {
+        list_del(&slab->list);
+        __slab_retire(slab);
+    } else if (slab->inuse == slab->total - 1) {
+        list_del(&slab->list);
+        list_add(&slab->list, &depot->partial);
+    }
+}
+
+/* Called with depot->lock held */
+static void __depot_put(mem_depot_t *depot, mem_mag_t *mag)
+{
+    if (mag == NULL) {
+        return;
+    }
+
+    if (mag->rounds && depot->n_full >= MEM_DEPOT_MAX) {
+        /* No room for another full magazine, give its rounds back */
+        while (mag->rounds) {
+            __slab_put(depot, mag->round[--mag->rounds]);
+        }
+    }
+
+    if (mag->rounds) {
+        mag->next = depot->full;
+        depot->full = mag;
+        depot->n_full++;
+    } else if (depot->n_empty < MEM_DEPOT_MAX) {
+        mag->next = depot->empty;
+        depot->empty = mag;
+        depot->n_empty++;
+    } else {
+        free(mag);
+    }
+}
+
+static mem_mag_t *__depot_get(mem_depot_t *depot, int full)
+{
+    mem_mag_t *mag = NULL;
+
+    if (full) {
+        mag = depot->full;
+        if (mag) {
+            depot->full = mag->next;
+            depot->n_full--;
+        }
+    } else {
+        mag = depot->empty;
+        if (mag) {
+            depot->empty = mag->next;
+            depot->n_empty--;
+        }
+    }
+
+    return mag;
+}
+
+static void __cache_flush(mem_tls_t *tls)
+{
+    size_t i;
+    mem_info_t *info = &s_mem_info;
+
+    for (i = 0; i < info->num; i++) {
+        mem_depot_t *depot = &info->depot[i];
+        mem_cache_t *cache = &tls->cache[i];
+
+        pthread_mutex_lock(&depot->lock);
+        __depot_put(depot, cache->loaded);
+        __depot_put(depot, cache->previous);
+        pthread_mutex_unlock(&depot->lock);
+        cache->loaded = NULL;
+        cache->previous = NULL;
+    }
+
+    __stat_fold(tls);
+}
+
+static void __tls_destructor(void *arg)
+{
+    mem_tls_t *tls = arg;
+
+    __cache_flush(tls);
+    tls->inited = 0;
+}
+
+static void __mem_init(void)
+{
+    size_t i;
+    mem_info_t *info = &s_mem_info;
+
+    for (i = 0; i < info->num; i++) {
+        mem_depot_t *depot = &info->depot[i];
+
+        depot->size = POW2(i);
+        depot->mag_size = MEM_MAG_BYTES / depot->size;
+        if (depot->mag_size > MEM_MAG_SIZE) {
+            depot->mag_size = MEM_MAG_SIZE;
+        }
+        if (depot->mag_size < 2) {
+            depot->mag_size = 2;
+        }
+        INIT_LIST_HEAD(&depot->partial);
+        INIT_LIST_HEAD(&depot->used);
+        INIT_LIST_HEAD(&depot->idle);
+    }
+
+    if (pthread_key_create(&info->key, __tls_destructor)) {
+        errorf("pthread_key_create err\n");
+    }
+}
+
+static mem_tls_t *__get_tls(void)
+{
+    mem_tls_t *tls = &s_mem_tls;
+
+    if (!tls->inited) {
+        /* Register the thread so its magazines go back to the depot on exit */
+        pthread_once(&s_mem_info.once, __mem_init);
+        pthread_setspecific(s_mem_info.key, tls);
+        tls->inited = 1;
+    }
+
+    return tls;
+}
+
+static mem_mag_t *__mag_new(void)
+{
+    mem_mag_t *mag = (mem_mag_t *)malloc(sizeof(mem_mag_t));
+    if (mag == NULL) {
+        errorf("malloc err\n");
+        return NULL;
+    }
+
+    mag->next = NULL;
+    mag->rounds = 0;
+    return mag;
+}
+
+/* Called with depot->lock held */
+static int __mag_fill(mem_depot_t *depot, size_t index, mem_mag_t *mag)
+{
+    mem_obj_t *obj = NULL;
+
+    while (mag->rounds < depot->mag_size) {
+        obj = __slab_get(depot, index);
+        if (obj == NULL) {
+            break;
+        }
+        mag->round[mag->rounds++] = obj;
+    }
+
+    return mag->rounds ? 0 : -1;
+}
+
+static mem_obj_t *__cache_alloc(size_t index)
+{
+    int status = 0;
+    mem_tls_t *tls = __get_tls();
+    mem_cache_t *cache = &tls->cache[index];
+    mem_depot_t *depot = &s_mem_info.depot[index];
+    mem_mag_t *mag = NULL;
+
+    if (cache->loaded && cache->loaded->rounds) {
+        tls->stat.alloc_hits++;
+        return cache->loaded->round[--cache->loaded->rounds];
+    }
+
+    if (cache->previous && cache->previous->rounds) {
+        mag = cache->previous;
+        cache->previous = cache->loaded;
+        cache->loaded = mag;
+        tls->stat.alloc_hits++;
+        return cache->loaded->round[--cache->loaded->rounds];
+    }
+
+    if (cache->loaded == NULL) {
+        cache->loaded = __mag_new();
+        if (cache->loaded == NULL) {
+            return NULL;
+        }
+    }
+
+    /* Both magazines are empty, trade one of them for a full one */
+    pthread_mutex_lock(&depot->lock);
+    mag = __depot_get(depot, 1);
+    if (mag) {
+        __depot_put(depot, cache->previous);
+        cache->previous = cache->loaded;
+        cache->loaded = mag;
+    } else {
+        status = __mag_fill(depot, index, cache->loaded);
+    }
+    pthread_mutex_unlock(&depot->lock);
+
+    tls->stat.alloc_misses++;
+    __stat_fold(tls);
+
+    if (status) {
+        return NULL;
+    }
+
+    return cache->loaded->round[--cache->loaded->rounds];
+}
+
+static void __cache_free(size_t index, mem_obj_t *obj)
+{
+    mem_tls_t *tls = __get_tls();
+    mem_cache_t *cache = &tls->cache[index];
+    mem_depot_t *depot = &s_mem_info.depot[index];
+    mem_mag_t *mag = NULL;
+
+    if (cache->loaded && cache->loaded->rounds < depot->mag_size) {
+        tls->stat.free_hits++;
+        cache->loaded->round[cache->loaded->rounds++] = obj;
+        return;
+    }
+
+    if (cache->previous && cache->previous->rounds == 0) {
+        mag = cache->previous;
+        cache->previous = cache->loaded;
+        cache->loaded = mag;
+        tls->stat.free_hits++;
+        cache->loaded->round[cache->loaded->rounds++] = obj;
+        return;
+    }
+
+    /* Both magazines are full, trade one of them for an empty one */
+    pthread_mutex_lock(&depot->lock);
+    __depot_put(depot, cache->previous);
+    cache->previous = cache->loaded;
+    mag = __depot_get(depot, 0);
+    if (mag == NULL) {
+        mag = __mag_new();
+    }
+    if (mag == NULL) {
+        __slab_put(depot, obj);
+    }
+    pthread_mutex_unlock(&depot->lock);
+
+    tls->stat.free_misses++;
+    __stat_fold(tls);
+
+    cache->loaded = mag;
+    if (mag) {
+        cache->loaded->round[cache->loaded->rounds++] = obj;
+    }
+}
+
 void *mem_alloc(size_t size)
 {
     size_t index;
-    void *ret = NULL;
     mem_info_t *info = &s_mem_info;
     mem_obj_t *obj = NULL;
 
@@ -93,28 +522,16 @@ void *mem_alloc(size_t size)
         return obj->data;
     }
 
-    pthread_mutex_lock(&info->lock);
     size = __get_block_size(size);
     index = __get_array_index(size);
-    obj = info->array[index];
+    obj = __cache_alloc(index);
     if (obj == NULL) {
-        obj = (mem_obj_t *)malloc(sizeof(mem_obj_t) + size);
-        if (obj == NULL) {
-            errorf("malloc err\n");
-            ret = NULL;
-            goto end;
-        }
-        obj->header.next = NULL;
-        info->array[index] = obj;
+        errorf("__cache_alloc err\n");
+        return NULL;
     }
 
-    info->array[index] = obj->header.next;
     obj->header.size = size;
-    ret = obj->data;
-end:
-    pthread_mutex_unlock(&info->lock);
-
-    return ret;
+    return obj->data;
 }
 
 void mem_free(void *ptr)
@@ -133,27 +550,105 @@ void mem_free(void *ptr)
         return;
     }
 
-    pthread_mutex_lock(&info->lock);
     index = __get_array_index(obj->header.size);
-    obj->header.next = info->array[index];
-    info->array[index] = obj;
-    pthread_mutex_unlock(&info->lock);
+    __cache_free(index, obj);
+}
+
+int mem_set_high_water(size_t bytes)
+{
+    size_t i;
+    mem_info_t *info = &s_mem_info;
+    mem_slab_t *slab = NULL;
+
+    pthread_once(&info->once, __mem_init);
+    __atomic_store_n(&info->high_water, bytes, __ATOMIC_RELAXED);
+
+    /* Trim the slabs already kept beyond the new mark */
+    for (i = 0; i < info->num; i++) {
+        mem_depot_t *depot = &info->depot[i];
+
+        pthread_mutex_lock(&depot->lock);
+        while (!list_empty(&depot->idle) &&
+               __atomic_load_n(&info->stat.slab_idle_bytes, __ATOMIC_RELAXED) > bytes) {
+            slab = list_entry(depot->idle.next, mem_slab_t, list);
+            list_del(&slab->list);
+            __atomic_fetch_sub(&info->stat.slab_idle_bytes, MEM_SLAB_SIZE, __ATOMIC_RELAXED);
+            __slab_delete(slab);
+        }
+        pthread_mutex_unlock(&depot->lock);
+    }
+
+    return 0;
+}
+
+int mem_get_stat(mem_stat_t *stat)
+{
+    mem_info_t *info = &s_mem_info;
+    mem_tls_t *tls = &s_mem_tls;
+
+    if (stat == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    __stat_fold(tls);
+    stat->alloc_hits = __atomic_load_n(&info->stat.alloc_hits, __ATOMIC_RELAXED);
+    stat->alloc_misses = __atomic_load_n(&info->stat.alloc_misses, __ATOMIC_RELAXED);
+    stat->free_hits = __atomic_load_n(&info->stat.free_hits, __ATOMIC_RELAXED);
+    stat->free_misses = __atomic_load_n(&info->stat.free_misses, __ATOMIC_RELAXED);
+    stat->slab_bytes = __atomic_load_n(&info->stat.slab_bytes, __ATOMIC_RELAXED);
+    stat->slab_idle_bytes = __atomic_load_n(&info->stat.slab_idle_bytes, __ATOMIC_RELAXED);
+    stat->slab_releases = __atomic_load_n(&info->stat.slab_releases, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static void __mag_release(mem_depot_t *depot, mem_mag_t *mag)
+{
+    mem_mag_t *tmp = NULL;
+
+    while (mag) {
+        tmp = mag;
+        mag = mag->next;
+        while (tmp->rounds) {
+            __slab_put(depot, tmp->round[--tmp->rounds]);
+        }
+        free(tmp);
+    }
 }
 
 static void __attribute__((destructor)) __mem_deinit()
 {
     size_t i;
     mem_info_t *info = &s_mem_info;
-    mem_obj_t *obj, *tmp = NULL;
+    mem_slab_t *slab = NULL;
+    list_t *p, *tmp;
 
-    pthread_mutex_lock(&info->lock);
+    if (s_mem_tls.inited) {
+        __cache_flush(&s_mem_tls);
+    }
+
+    /* Slabs with blocks still in use are left mapped */
     for (i = 0; i < info->num; i++) {
-        obj = info->array[i];
-        while (obj) {
-            tmp = obj;
-            obj = obj->header.next;
-            free(tmp);
+        mem_depot_t *depot = &info->depot[i];
+
+        if (depot->size == 0) {
+            continue;
         }
+
+        pthread_mutex_lock(&depot->lock);
+        __mag_release(depot, depot->full);
+        __mag_release(depot, depot->empty);
+        depot->full = NULL;
+        depot->empty = NULL;
+        depot->n_full = 0;
+        depot->n_empty = 0;
+        list_for_each_safe(p, tmp, &depot->idle) {
+            slab = list_entry(p, mem_slab_t, list);
+            list_del(&slab->list);
+            __atomic_fetch_sub(&info->stat.slab_idle_bytes, MEM_SLAB_SIZE, __ATOMIC_RELAXED);
+            __slab_delete(slab);
+        }
+        pthread_mutex_unlock(&depot->lock);
     }
-    pthread_mutex_unlock(&info->lock);
-}
\ No newline at end of file
+}
@@ -9,24 +9,720 @@
 #include "log.h"
 #include "mem.h"
 
+#define QUE_RING_CAPACITY (1024)
+#define QUE_CACHELINE (64)
+
+typedef struct {
+    size_t seq;
+    void *element;
+} que_slot_t;
+
 typedef struct {
+    size_t mask;
+    que_slot_t *slots;
+    char pad0[QUE_CACHELINE];
+    size_t enqueue_pos;
+    char pad1[QUE_CACHELINE - sizeof(size_t)];
+    size_t dequeue_pos;
+    char pad2[QUE_CACHELINE - sizeof(size_t)];
+    long count;
+    int waiters;
+    /* Under the lock, what que_put_to_head put in front of the ring */
     list_t head;
-    unsigned long count;
+    long n_head;
+} que_ring_t;
+
+struct que_func;
+
+typedef struct {
+    que_attr_t attr;
+    const struct que_func *func;
     pthread_mutex_t lock;
     pthread_cond_t cond;
+    union {
+        struct {
+            list_t head[QUE_LEVEL_MAX];
+            unsigned int map;       /* bit n set when head[n] is not empty */
+            unsigned int streak;    /* gets since a lower level was served */
+            int cursor;             /* the lower level served last */
+            unsigned long count;
+            int waiters;
+        } list;
+        que_ring_t ring;
+    };
 } que_priv_t;
 
+typedef struct que_func {
+    int (*create)(que_priv_t *pPriv);
+    void (*delete)(que_priv_t *pPriv);
+    int (*put)(que_priv_t *pPriv, void *element, int to_head);
+    int (*put_batch)(que_priv_t *pPriv, void **elements, int n);
+    int (*get)(que_priv_t *pPriv, void **element, int isblock);
+    int (*get_batch)(que_priv_t *pPriv, void **elements, int n, int isblock);
+    int (*remove)(que_priv_t *pPriv, void *element);
+    int (*len)(que_priv_t *pPriv);
+    int (*level)(que_priv_t *pPriv);
+} que_func_t;
+
 typedef struct {
-    list_t list;
+    que_link_t link;
     void *element;
 } que_node_t;
 
+/* Wake at most n of the given number of parked consumers */
+static void __wake(que_priv_t *pPriv, int n, int waiters)
+{
+    if (n >= waiters) {
+        if (waiters) {
+            pthread_cond_broadcast(&pPriv->cond);
+        }
+        return;
+    }
+
+    while (n--) {
+        pthread_cond_signal(&pPriv->cond);
+    }
+}
+
+static que_link_t *__node_new(que_priv_t *pPriv, void *element)
+{
+    que_node_t *pNode = NULL;
+    que_link_t *pLink = NULL;
+
+    if (pPriv->attr.type == QUE_TYPE_INTRUSIVE) {
+        pLink = (que_link_t *)((char *)element + pPriv->attr.offset);
+        if (pLink->owner) {
+            errorf("element %p already queued\n", element);
+            return NULL;
+        }
+        return pLink;
+    }
+
+    pNode = (que_node_t *)mem_alloc(sizeof(que_node_t));
+    if (pNode == NULL) {
+        errorf("mem_alloc err\n");
+        return NULL;
+    }
+    pNode->element = element;
+    pNode->link.prio = 0;
+
+    return &pNode->link;
+}
+
+static void *__node_element(que_priv_t *pPriv, que_link_t *pLink)
+{
+    if (pPriv->attr.type == QUE_TYPE_INTRUSIVE) {
+        return (char *)pLink - pPriv->attr.offset;
+    }
+
+    return list_entry(pLink, que_node_t, link)->element;
+}
+
+static inline int __node_level(que_priv_t *pPriv, que_link_t *pLink)
+{
+    if (pPriv->attr.levels <= 1 || pLink->prio < 0) {
+        return 0;
+    }
+
+    return pLink->prio < pPriv->attr.levels ? pLink->prio : pPriv->attr.levels - 1;
+}
+
+/* Called with pPriv->lock held */
+static void __node_link(que_priv_t *pPriv, que_link_t *pLink, int to_head)
+{
+    int level = __node_level(pPriv, pLink);
+
+    if (to_head) {
+        list_add(&pLink->list, &pPriv->list.head[level]);
+    } else {
+        list_add_tail(&pLink->list, &pPriv->list.head[level]);
+    }
+    __atomic_store_n(&pPriv->list.map, pPriv->list.map | 1u << level, __ATOMIC_RELAXED);
+    pLink->owner = pPriv;
+}
+
+/* Called with pPriv->lock held */
+static void __node_unlink(que_priv_t *pPriv, que_link_t *pLink)
+{
+    int level = __node_level(pPriv, pLink);
+
+    list_del(&pLink->list);
+    if (list_empty(&pPriv->list.head[level])) {
+        __atomic_store_n(&pPriv->list.map, pPriv->list.map & ~(1u << level), __ATOMIC_RELAXED);
+    }
+    pLink->owner = NULL;
+    __atomic_store_n(&pPriv->list.count, pPriv->list.count - 1, __ATOMIC_RELAXED);
+
+    if (pPriv->attr.type != QUE_TYPE_INTRUSIVE) {
+        mem_free(list_entry(pLink, que_node_t, link));
+    }
+}
+
+/*
+ * Called with pPriv->lock held on a non-empty list. The highest non-empty
+ * level wins, except every aging-th time when the next lower non-empty level
+ * in turn is served so that none of them starves.
+ */
+static que_link_t *__list_first(que_priv_t *pPriv)
+{
+    unsigned int map = pPriv->list.map;
+    unsigned int lower;
+    int level = 31 - __builtin_clz(map);
+
+    if (pPriv->attr.aging > 0 && ++pPriv->list.streak >= pPriv->attr.aging) {
+        pPriv->list.streak = 0;
+        lower = map & ((1u << level) - 1);
+        if (lower) {
+            map = lower & ((1u << pPriv->list.cursor) - 1);
+            level = 31 - __builtin_clz(map ? map : lower);
+            pPriv->list.cursor = level;
+        }
+    }
+
+    return list_entry(pPriv->list.head[level].next, que_link_t, list);
+}
+
+static int __list_create(que_priv_t *pPriv)
+{
+    int i;
+
+    if (pPriv->attr.levels > QUE_LEVEL_MAX) {
+        errorf("at most %d levels\n", QUE_LEVEL_MAX);
+        return -1;
+    }
+
+    for (i = 0; i < QUE_LEVEL_MAX; i++) {
+        INIT_LIST_HEAD(&pPriv->list.head[i]);
+    }
+    return 0;
+}
+
+static void __list_delete(que_priv_t *pPriv)
+{
+    int i;
+    que_link_t *pLink = NULL;
+    list_t *p, *tmp;
+
+    pthread_mutex_lock(&pPriv->lock);
+    for (i = 0; i < QUE_LEVEL_MAX; i++) {
+        list_for_each_safe(p, tmp, &pPriv->list.head[i]) {
+            pLink = list_entry(p, que_link_t, list);
+            tracef("pLink:%p\n", pLink);
+            __node_unlink(pPriv, pLink);
+        }
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+}
+
+static int __list_put(que_priv_t *pPriv, void *element, int to_head)
+{
+    int waiters;
+    que_link_t *pLink = NULL;
+
+    pLink = __node_new(pPriv, element);
+    if (pLink == NULL) {
+        errorf("__node_new err\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&pPriv->lock);
+    __node_link(pPriv, pLink, to_head);
+    __atomic_store_n(&pPriv->list.count, pPriv->list.count + 1, __ATOMIC_RELAXED);
+    waiters = pPriv->list.waiters;
+    pthread_mutex_unlock(&pPriv->lock);
+
+    __wake(pPriv, 1, waiters);
+
+    return 0;
+}
+
+static int __list_put_batch(que_priv_t *pPriv, void **elements, int n)
+{
+    int i, waiters;
+    list_t batch;
+    que_link_t *pLink = NULL;
+    list_t *p, *tmp;
+
+    /* Link the batch privately, then splice it in one critical section */
+    INIT_LIST_HEAD(&batch);
+    for (i = 0; i < n; i++) {
+        pLink = __node_new(pPriv, elements[i]);
+        if (pLink == NULL) {
+            errorf("__node_new err\n");
+            break;
+        }
+        list_add_tail(&pLink->list, &batch);
+    }
+    n = i;
+
+    if (i == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&pPriv->lock);
+    list_for_each_safe(p, tmp, &batch) {
+        __node_link(pPriv, list_entry(p, que_link_t, list), 0);
+    }
+    __atomic_store_n(&pPriv->list.count, pPriv->list.count + n, __ATOMIC_RELAXED);
+    waiters = pPriv->list.waiters;
+    pthread_mutex_unlock(&pPriv->lock);
+
+    __wake(pPriv, n, waiters);
+
+    return n;
+}
+
+static int __list_get_batch(que_priv_t *pPriv, void **elements, int n, int isblock)
+{
+    int ret = 0, status, level;
+    que_link_t *pLink = NULL;
+
+    pthread_mutex_lock(&pPriv->lock);
+    while (1) {
+        if (pPriv->list.map) {
+            /* A batch ends at the level of its first element */
+            pLink = __list_first(pPriv);
+            level = __node_level(pPriv, pLink);
+            while (1) {
+                elements[ret++] = __node_element(pPriv, pLink);
+                __node_unlink(pPriv, pLink);
+                if (ret == n || list_empty(&pPriv->list.head[level])) {
+                    break;
+                }
+                /* Each job counts toward aging, the aging-th is for __list_first */
+                if (pPriv->attr.aging > 0 && (pPriv->list.map & ((1u << level) - 1))) {
+                    if (pPriv->list.streak + 1 >= pPriv->attr.aging) {
+                        break;
+                    }
+                    pPriv->list.streak++;
+                }
+                pLink = list_entry(pPriv->list.head[level].next, que_link_t, list);
+            }
+            break;
+        } else {
+            if (!isblock) {
+                ret = -1;
+                break;
+            }
+
+            pPriv->list.waiters++;
+            status = pthread_cond_wait(&pPriv->cond, &pPriv->lock);
+            pPriv->list.waiters--;
+            if (status) {
+                errorf("pthread_cond_wait err\n");
+                ret = -1;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+
+    return ret;
+}
+
+static int __list_get(que_priv_t *pPriv, void **element, int isblock)
+{
+    return __list_get_batch(pPriv, element, 1, isblock) == 1 ? 0 : -1;
+}
+
+static int __list_remove(que_priv_t *pPriv, void *element)
+{
+    int status = -1;
+    que_link_t *pLink = NULL;
+    list_t *p, *tmp;
+
+    pthread_mutex_lock(&pPriv->lock);
+    if (pPriv->attr.type == QUE_TYPE_INTRUSIVE) {
+        /* The link tells which queue holds the element, no scan needed */
+        pLink = (que_link_t *)((char *)element + pPriv->attr.offset);
+        if (pLink->owner == pPriv) {
+            __node_unlink(pPriv, pLink);
+            status = 0;
+        }
+    } else {
+        /* Plain nodes carry no level, they all sit on the first one */
+        list_for_each_safe(p, tmp, &pPriv->list.head[0]) {
+            pLink = list_entry(p, que_link_t, list);
+            if (__node_element(pPriv, pLink) == element) {
+                __node_unlink(pPriv, pLink);
+                status = 0;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+
+    return status;
+}
+
+static int __list_len(que_priv_t *pPriv)
+{
+    /* Written under the lock, a racy read is a fine estimate */
+    return __atomic_load_n(&pPriv->list.count, __ATOMIC_RELAXED);
+}
+
+static int __list_level(que_priv_t *pPriv)
+{
+    /* Same as the count, a racy read without the lock */
+    unsigned int map = __atomic_load_n(&pPriv->list.map, __ATOMIC_RELAXED);
+
+    return map ? 31 - __builtin_clz(map) : -1;
+}
+
+/*
+ * Bounded MPMC ring with a sequence number per slot. A slot is free for
+ * the producer at position pos when seq == pos, and holds an element for
+ * the consumer at position pos when seq == pos + 1. Consumers take the
+ * element with an atomic exchange, so que_remove can steal it first by
+ * clearing the slot, leaving a hole the consumer skips. A put to the
+ * head goes to an unbounded list in front of the ring instead, so putting
+ * an element back never finds the ring full.
+ */
+static int __ring_create(que_priv_t *pPriv)
+{
+    size_t i, capacity = QUE_RING_CAPACITY;
+    que_ring_t *ring = &pPriv->ring;
+
+    if (pPriv->attr.capacity) {
+        for (capacity = 1; capacity < pPriv->attr.capacity; capacity <<= 1)
+            ;
+    }
+
+    ring->slots = (que_slot_t *)mem_alloc(capacity * sizeof(que_slot_t));
+    if (ring->slots == NULL) {
+        errorf("mem_alloc err\n");
+        return -1;
+    }
+
+    for (i = 0; i < capacity; i++) {
+        ring->slots[i].seq = i;
+        ring->slots[i].element = NULL;
+    }
+    ring->mask = capacity - 1;
+    ring->enqueue_pos = 0;
+    ring->dequeue_pos = 0;
+    ring->count = 0;
+    ring->waiters = 0;
+    INIT_LIST_HEAD(&ring->head);
+    ring->n_head = 0;
+
+    return 0;
+}
+
+static void __ring_delete(que_priv_t *pPriv)
+{
+    list_t *p, *tmp;
+
+    list_for_each_safe(p, tmp, &pPriv->ring.head) {
+        mem_free(list_entry(p, que_node_t, link.list));
+    }
+    mem_free(pPriv->ring.slots);
+}
+
+static int __ring_push(que_ring_t *ring, void *element)
+{
+    long dif;
+    que_slot_t *slot = NULL;
+    size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+
+    while (1) {
+        slot = &ring->slots[pos & ring->mask];
+        dif = (long)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (long)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    __atomic_store_n(&slot->element, element, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&ring->count, 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static int __ring_pop(que_ring_t *ring, void **element)
+{
+    long dif;
+    void *tmp = NULL;
+    que_slot_t *slot = NULL;
+    size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+
+    while (1) {
+        slot = &ring->slots[pos & ring->mask];
+        dif = (long)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (long)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                tmp = __atomic_exchange_n(&slot->element, NULL, __ATOMIC_ACQUIRE);
+                __atomic_store_n(&slot->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+                if (tmp) {
+                    break;
+                }
+                /* Removed by que_remove, try the next slot */
+                pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+            }
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    __atomic_fetch_sub(&ring->count, 1, __ATOMIC_RELAXED);
+    *element = tmp;
+
+    return 0;
+}
+
+/* Called with pPriv->lock held */
+static int __ring_head_pop(que_ring_t *ring, void **element)
+{
+    que_node_t *pNode = NULL;
+
+    if (list_empty(&ring->head)) {
+        return -1;
+    }
+
+    pNode = list_entry(ring->head.next, que_node_t, link.list);
+    list_del(&pNode->link.list);
+    __atomic_store_n(&ring->n_head, ring->n_head - 1, __ATOMIC_RELAXED);
+    *element = pNode->element;
+    mem_free(pNode);
+
+    return 0;
+}
+
+/* The elements put to the head come first, the lock is taken only for them */
+static int __ring_take(que_priv_t *pPriv, void **element)
+{
+    int status = -1;
+    que_ring_t *ring = &pPriv->ring;
+
+    if (__atomic_load_n(&ring->n_head, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&pPriv->lock);
+        status = __ring_head_pop(ring, element);
+        pthread_mutex_unlock(&pPriv->lock);
+    }
+
+    return status ? __ring_pop(ring, element) : 0;
+}
+
+static int __ring_put(que_priv_t *pPriv, void *element, int to_head)
+{
+    que_ring_t *ring = &pPriv->ring;
+    que_node_t *pNode = NULL;
+
+    if (to_head) {
+        pNode = (que_node_t *)mem_alloc(sizeof(que_node_t));
+        if (pNode == NULL) {
+            errorf("mem_alloc err\n");
+            return -1;
+        }
+        pNode->element = element;
+
+        /* Waiters check the list under the lock, the wake cannot be lost */
+        pthread_mutex_lock(&pPriv->lock);
+        list_add(&pNode->link.list, &ring->head);
+        __atomic_store_n(&ring->n_head, ring->n_head + 1, __ATOMIC_RELEASE);
+        __wake(pPriv, 1, ring->waiters);
+        pthread_mutex_unlock(&pPriv->lock);
+        return 0;
+    }
+
+    if (__ring_push(ring, element)) {
+        errorf("que full\n");
+        return -1;
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiters, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&pPriv->lock);
+        __wake(pPriv, 1, ring->waiters);
+        pthread_mutex_unlock(&pPriv->lock);
+    }
+
+    return 0;
+}
+
+static int __ring_put_batch(que_priv_t *pPriv, void **elements, int n)
+{
+    int i;
+    que_ring_t *ring = &pPriv->ring;
+
+    for (i = 0; i < n; i++) {
+        if (__ring_push(ring, elements[i])) {
+            errorf("que full\n");
+            break;
+        }
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (i && __atomic_load_n(&ring->waiters, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&pPriv->lock);
+        __wake(pPriv, i, ring->waiters);
+        pthread_mutex_unlock(&pPriv->lock);
+    }
+
+    return i;
+}
+
+static int __ring_get(que_priv_t *pPriv, void **element, int isblock)
+{
+    int status = 0;
+    que_ring_t *ring = &pPriv->ring;
+
+    if (__ring_take(pPriv, element) == 0) {
+        return 0;
+    }
+
+    if (!isblock) {
+        return -1;
+    }
+
+    /* Park only while the ring stays empty after announcing ourselves */
+    pthread_mutex_lock(&pPriv->lock);
+    __atomic_fetch_add(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+    while (__ring_head_pop(ring, element) && __ring_pop(ring, element)) {
+        status = pthread_cond_wait(&pPriv->cond, &pPriv->lock);
+        if (status) {
+            errorf("pthread_cond_wait err\n");
+            status = -1;
+            break;
+        }
+    }
+    __atomic_fetch_sub(&ring->waiters, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pPriv->lock);
+
+    return status;
+}
+
+static int __ring_get_batch(que_priv_t *pPriv, void **elements, int n, int isblock)
+{
+    int i;
+
+    if (__ring_get(pPriv, &elements[0], isblock)) {
+        return -1;
+    }
+
+    for (i = 1; i < n; i++) {
+        if (__ring_take(pPriv, &elements[i])) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+static int __ring_remove(que_priv_t *pPriv, void *element)
+{
+    size_t pos, end;
+    void *tmp = NULL;
+    que_ring_t *ring = &pPriv->ring;
+    que_node_t *pNode = NULL;
+    list_t *p, *q;
+
+    if (__atomic_load_n(&ring->n_head, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&pPriv->lock);
+        list_for_each_safe(p, q, &ring->head) {
+            pNode = list_entry(p, que_node_t, link.list);
+            if (pNode->element == element) {
+                list_del(&pNode->link.list);
+                __atomic_store_n(&ring->n_head, ring->n_head - 1, __ATOMIC_RELAXED);
+                pthread_mutex_unlock(&pPriv->lock);
+                mem_free(pNode);
+                return 0;
+            }
+        }
+        pthread_mutex_unlock(&pPriv->lock);
+    }
+
+    /* Only the window between the two positions can hold elements */
+    pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_ACQUIRE);
+    end = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_ACQUIRE);
+    for (; pos != end; pos++) {
+        tmp = element;
+        if (__atomic_compare_exchange_n(&ring->slots[pos & ring->mask].element, &tmp, NULL, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            __atomic_fetch_sub(&ring->count, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int __ring_len(que_priv_t *pPriv)
+{
+    long ret = __atomic_load_n(&pPriv->ring.count, __ATOMIC_RELAXED) +
+               __atomic_load_n(&pPriv->ring.n_head, __ATOMIC_RELAXED);
+
+    return ret < 0 ? 0 : ret;
+}
+
+static int __ring_level(que_priv_t *pPriv)
+{
+    /* FIFO only, everything sits on level 0 */
+    return __ring_len(pPriv) ? 0 : -1;
+}
+
+static const que_func_t s_que_func[] = {
+    [QUE_TYPE_LIST] = {
+        .create = __list_create,
+        .delete = __list_delete,
+        .put = __list_put,
+        .put_batch = __list_put_batch,
+        .get = __list_get,
+        .get_batch = __list_get_batch,
+        .remove = __list_remove,
+        .len = __list_len,
+        .level = __list_level,
+    },
+    [QUE_TYPE_INTRUSIVE] = {
+        .create = __list_create,
+        .delete = __list_delete,
+        .put = __list_put,
+        .put_batch = __list_put_batch,
+        .get = __list_get,
+        .get_batch = __list_get_batch,
+        .remove = __list_remove,
+        .len = __list_len,
+        .level = __list_level,
+    },
+    [QUE_TYPE_RING] = {
+        .create = __ring_create,
+        .delete = __ring_delete,
+        .put = __ring_put,
+        .put_batch = __ring_put_batch,
+        .get = __ring_get,
+        .get_batch = __ring_get_batch,
+        .remove = __ring_remove,
+        .len = __ring_len,
+        .level = __ring_level,
+    },
+};
+
 int que_create(void **handle)
+{
+    const que_attr_t attr = {
+        .type = QUE_TYPE_LIST,
+    };
+
+    return que_create_ex(&attr, handle);
+}
+
+int que_create_ex(const que_attr_t *attr, void **handle)
 {
     int status;
     que_priv_t *pPriv = NULL;
 
-    if (handle == NULL) {
+    if (attr == NULL || attr->type >= QUE_TYPE_NONE || handle == NULL) {
         errorf("paramter err\n");
         goto err;
     }
@@ -38,6 +734,8 @@ int que_create(void **handle)
     }
 
     memset(pPriv, 0, sizeof(que_priv_t));
+    memcpy(&pPriv->attr, attr, sizeof(que_attr_t));
+    pPriv->func = &s_que_func[attr->type];
     status = pthread_mutex_init(&pPriv->lock, NULL);
     if (status) {
         errorf("pthread_mutex_init err\n");
@@ -48,7 +746,11 @@ int que_create(void **handle)
         errorf("pthread_cond_init err\n");
         goto err;
     }
-    INIT_LIST_HEAD(&pPriv->head);
+    status = pPriv->func->create(pPriv);
+    if (status) {
+        errorf("pPriv->func->create err\n");
+        goto err;
+    }
 
     *handle = pPriv;
     return 0;
@@ -66,24 +768,13 @@ err:
 int que_delete(void *handle)
 {
     que_priv_t *pPriv = (que_priv_t *)handle;
-    que_node_t *pNode = NULL;
-    list_t *p, *tmp;
 
     if (pPriv == NULL) {
         errorf("paramter err\n");
         return -1;
     }
 
-    pthread_mutex_lock(&pPriv->lock);
-    list_for_each_safe(p, tmp, &pPriv->head) {
-        pNode = list_entry(p, que_node_t, list);
-        list_del(&pNode->list);
-        pPriv->count--;
-        tracef("pNode:%p\n", pNode);
-        mem_free(pNode);
-    }
-    pthread_mutex_unlock(&pPriv->lock);
-
+    pPriv->func->delete(pPriv);
     pthread_mutex_destroy(&pPriv->lock);
     pthread_cond_destroy(&pPriv->cond);
 
@@ -95,159 +786,103 @@ int que_delete(void *handle)
 int que_put(void *handle, void *element)
 {
     que_priv_t *pPriv = (que_priv_t *)handle;
-    que_node_t *pNode = NULL;
 
     if (pPriv == NULL || element == NULL) {
         errorf("paramter err\n");
         return -1;
     }
 
-    pNode = (que_node_t *)mem_alloc(sizeof(que_node_t));
-    if (pNode == NULL) {
-        errorf("paramter err\n");
-        return -1;
-    }
-    pNode->element = element;
-
-    pthread_mutex_lock(&pPriv->lock);
-    list_add_tail(&pNode->list, &pPriv->head);
-    pPriv->count++;
-    pthread_mutex_unlock(&pPriv->lock);
-
-    pthread_cond_signal(&pPriv->cond);
-
-    return 0;
+    return pPriv->func->put(pPriv, element, 0);
 }
 
 int que_put_to_head(void *handle, void *element)
 {
     que_priv_t *pPriv = (que_priv_t *)handle;
-    que_node_t *pNode = NULL;
 
     if (pPriv == NULL || element == NULL) {
         errorf("paramter err\n");
         return -1;
     }
 
-    pNode = (que_node_t *)mem_alloc(sizeof(que_node_t));
-    if (pNode == NULL) {
+    return pPriv->func->put(pPriv, element, 1);
+}
+
+int que_put_batch(void *handle, void **elements, int n)
+{
+    int i;
+    que_priv_t *pPriv = (que_priv_t *)handle;
+
+    if (pPriv == NULL || elements == NULL || n < 0) {
         errorf("paramter err\n");
         return -1;
     }
-    pNode->element = element;
 
-    pthread_mutex_lock(&pPriv->lock);
-    list_add(&pNode->list, &pPriv->head);
-    pPriv->count++;
-    pthread_mutex_unlock(&pPriv->lock);
-
-    pthread_cond_signal(&pPriv->cond);
+    for (i = 0; i < n; i++) {
+        if (elements[i] == NULL) {
+            errorf("paramter err\n");
+            return -1;
+        }
+    }
 
-    return 0;
+    return pPriv->func->put_batch(pPriv, elements, n);
 }
 
 int que_get(void *handle, void **element, int isblock)
 {
-    int status = 0;
     que_priv_t *pPriv = (que_priv_t *)handle;
-    que_node_t *pNode = NULL;
 
     if (pPriv == NULL || element == NULL) {
         errorf("paramter err\n");
         return -1;
     }
 
-    pthread_mutex_lock(&pPriv->lock);
-    while (1) {
-        if (!list_empty(&pPriv->head)) {
-            pNode = list_entry(pPriv->head.next, que_node_t, list);
-            list_del(&pNode->list);
-            pPriv->count--;
-            *element = pNode->element;
-            mem_free(pNode);
-            break;
-        } else {
-            if (!isblock) {
-                errorf("no element\n");
-                status = -1;
-                break;
-            }
-
-            status = pthread_cond_wait(&pPriv->cond, &pPriv->lock);
-            if (status) {
-                errorf("pthread_cond_wait err\n");
-                status = -1;
-                break;
-            }
-        }
-    }
-    pthread_mutex_unlock(&pPriv->lock);
-
-    return status;
+    return pPriv->func->get(pPriv, element, isblock);
 }
 
-int que_peek(void *handle, void **element)
+int que_get_batch(void *handle, void **elements, int n, int isblock)
 {
-    int status = -1;
     que_priv_t *pPriv = (que_priv_t *)handle;
-    que_node_t *pNode = NULL;
 
-    if (pPriv == NULL || element == NULL) {
+    if (pPriv == NULL || elements == NULL || n <= 0) {
         errorf("paramter err\n");
         return -1;
     }
 
-    pthread_mutex_lock(&pPriv->lock);
-    if (!list_empty(&pPriv->head)) {
-        pNode = list_entry(pPriv->head.next, que_node_t, list);
-        *element = pNode->element;
-        status = 0;
-    }
-    pthread_mutex_unlock(&pPriv->lock);
-
-    return status;
+    return pPriv->func->get_batch(pPriv, elements, n, isblock);
 }
 
 int que_remove(void *handle, void *element)
 {
-    int status = -1;
     que_priv_t *pPriv = (que_priv_t *)handle;
-    que_node_t *pNode = NULL;
-    list_t *p, *tmp;
 
     if (pPriv == NULL || element == NULL) {
         errorf("paramter err\n");
         return -1;
     }
 
-    pthread_mutex_lock(&pPriv->lock);
-    list_for_each_safe(p, tmp, &pPriv->head) {
-        pNode = list_entry(p, que_node_t, list);
-        if (pNode->element == element) {
-            list_del(&pNode->list);
-            pPriv->count--;
-            mem_free(pNode);
-            status = 0;
-            break;
-        }
-    }
-    pthread_mutex_unlock(&pPriv->lock);
-
-    return status;
+    return pPriv->func->remove(pPriv, element);
 }
 
 int que_len(void *handle)
 {
-    int ret;
     que_priv_t *pPriv = (que_priv_t *)handle;
+
     if (pPriv == NULL) {
         errorf("paramter err\n");
         return -1;
     }
 
-    pthread_mutex_lock(&pPriv->lock);
-    ret = pPriv->count;
-    pthread_mutex_unlock(&pPriv->lock);
+    return pPriv->func->len(pPriv);
+}
 
-    return ret;
-}
\ No newline at end of file
+int que_level(void *handle)
+{
+    que_priv_t *pPriv = (que_priv_t *)handle;
+
+    if (pPriv == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    return pPriv->func->level(pPriv);
+}
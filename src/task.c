@@ -3,19 +3,32 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/sysinfo.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
 
+#include "list.h"
 #include "log.h"
 #include "mem.h"
 
+#define TASK_STACK_SIZE (64 * 1024)
+#define TASK_STACK_POOL (64)
+#define TASK_CARRIER_MAX (16)
+#define TASK_IDLE_MIN_US (50)
+#define TASK_IDLE_MAX_US (1000)
+
+#if defined(__x86_64__)
+#define TASK_SWITCH_ASM
+#endif
+
 typedef struct {
     int (*create)(task_attr_t *attr, void **handle);
     int (*delete)(void *handle);
-    int (*set_affinity)(void *handle, size_t cpumask);
-    int (*set_schedpolicy)(void *handle, int policy);
-    int (*set_schedpriority)(void *handle, int priority);
 } task_func_t;
 
 typedef struct {
@@ -24,26 +37,120 @@ typedef struct {
     void *handle;
 } task_priv_t;
 
+typedef struct task_coro task_coro_t;
+
+typedef struct task_carrier {
+    pthread_mutex_t lock;
+    pthread_cond_t event;
+    list_t ready;           /* coroutines waiting for their turn */
+    list_t parked;          /* coroutines waiting for a task_unpark */
+    task_coro_t *current;   /* the coroutine on the carrier thread, if any */
+    int n_coros;
+    int n_parked;
+    int running;
+#ifdef TASK_SWITCH_ASM
+    void *sp;
+#else
+    ucontext_t ctx;
+#endif
+} task_carrier_t;
+
+struct task_coro {
+    list_t list;            /* on the ready or the parked list of its carrier */
+    task_attr_t attr;
+    task_carrier_t *carrier;
+    void *stack;
+#ifdef TASK_SWITCH_ASM
+    void *sp;               /* saved stack pointer while switched out */
+#else
+    ucontext_t ctx;
+#endif
+    int *word;              /* parked on, NULL if not parked */
+    int idle;               /* yielded with nothing to do */
+    int done;
+    int deleted;
+    int cancel;
+};
+
+static task_carrier_t s_carrier[TASK_CARRIER_MAX];
+static int s_n_carriers;
+static unsigned int s_next_carrier;
+static pthread_once_t s_carrier_once = PTHREAD_ONCE_INIT;
+
+/* Stacks of finished coroutines, kept for the next ones */
+static void *s_stack_pool;
+static int s_n_stacks;
+static pthread_mutex_t s_stack_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The coroutine running on the current carrier thread, if any */
+static __thread task_coro_t *s_coro;
+
+/* A mask of 0 or with every bit set leaves the affinity alone */
+static int __thread_cpuset(size_t cpumask, cpu_set_t *cpuset)
+{
+    int i;
+    int n = get_nprocs_conf();
+
+    if (cpumask == 0 || cpumask == (size_t)(-1)) {
+        return 0;
+    }
+
+    CPU_ZERO(cpuset);
+    for (i = 0; i < n && i < (int)(sizeof(cpumask) * 8); i++) {
+        if ((cpumask >> i) & 0x1) {
+            CPU_SET(i, cpuset);
+        }
+    }
+
+    return 1;
+}
+
 static int __thread_create(task_attr_t *attr, void **handle)
 {
     int status;
+    cpu_set_t cpuset;
+    pthread_attr_t thread_attr;
+    struct sched_param schedprm = {
+        .sched_priority = attr->priority,
+    };
     pthread_t *new = (pthread_t *)mem_alloc(sizeof(pthread_t));
     if (new == NULL) {
         errorf("mem_alloc err\n");
         return -1;
     }
 
-    status = pthread_create(new, NULL, attr->routine, attr->arg);
+    status = pthread_attr_init(&thread_attr);
+    assert(!status);
+    if (__thread_cpuset(attr->cpumask, &cpuset)) {
+        status |= pthread_attr_setaffinity_np(&thread_attr, sizeof(cpuset), &cpuset);
+    }
+    if (attr->policy != SCHED_OTHER || attr->priority) {
+        status |= pthread_attr_setinheritsched(&thread_attr, PTHREAD_EXPLICIT_SCHED);
+        status |= pthread_attr_setschedpolicy(&thread_attr, attr->policy);
+        status |= pthread_attr_setschedparam(&thread_attr, &schedprm);
+    }
+    if (status) {
+        errorf("pthread_attr_set err\n");
+        goto err;
+    }
+
+    status = pthread_create(new, &thread_attr, attr->routine, attr->arg);
     if (status) {
         errorf("pthread_create err\n");
-        return -1;
+        goto err;
     }
+    pthread_attr_destroy(&thread_attr);
 
     status = pthread_detach(*new);
     assert(!status);
 
     *handle = new;
     return 0;
+
+err:
+    pthread_attr_destroy(&thread_attr);
+    mem_free(new);
+    return -1;
 }
 
 static int __thread_delete(void *handle)
@@ -57,44 +164,329 @@ static int __thread_delete(void *handle)
     return 0;
 }
 
-static int __thread_set_affinity(void *handle, size_t cpumask)
+static void *__stack_get(void)
 {
-    int i;
-    cpu_set_t cpuset;
-    pthread_t *thread = handle;
+    void *stack = NULL;
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    pthread_mutex_lock(&s_stack_lock);
+    if (s_stack_pool) {
+        stack = s_stack_pool;
+        s_stack_pool = *(void **)stack;
+        s_n_stacks--;
+    }
+    pthread_mutex_unlock(&s_stack_lock);
+    if (stack) {
+        return stack;
+    }
 
-    CPU_ZERO(&cpuset);
-    for (i = 0; i < get_nprocs_conf(); i++) {
-        CPU_SET((cpumask >> i) & 0x1, &cpuset);
+    stack = mmap(NULL, TASK_STACK_SIZE + page, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        errorf("mmap err\n");
+        return NULL;
+    }
+    /* Guard page below the stack so an overflow faults at once */
+    if (mprotect(stack, page, PROT_NONE)) {
+        errorf("mprotect err\n");
+        munmap(stack, TASK_STACK_SIZE + page);
+        return NULL;
     }
 
-    return pthread_setaffinity_np(*thread, sizeof(cpuset), &cpuset);
+    return (char *)stack + page;
 }
 
-static int __thread_set_schedpolicy(void *handle, int policy)
+static void __stack_put(void *stack)
 {
-    int tmp;
-    pthread_t *thread = handle;
-    struct sched_param schedprm;
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    pthread_mutex_lock(&s_stack_lock);
+    if (s_n_stacks < TASK_STACK_POOL) {
+        *(void **)stack = s_stack_pool;
+        s_stack_pool = stack;
+        s_n_stacks++;
+        stack = NULL;
+    }
+    pthread_mutex_unlock(&s_stack_lock);
 
-    pthread_getschedparam(*thread, &tmp, &schedprm);
-    return pthread_setschedparam(*thread, policy, &schedprm);
+    if (stack) {
+        munmap((char *)stack - page, TASK_STACK_SIZE + page);
+    }
 }
 
-static int __thread_set_schedpriority(void *handle, int priority)
+static void __coro_entry(void);
+
+#ifdef TASK_SWITCH_ASM
+/* Save the callee-saved registers on the old stack and pop them off the new
+ * one, no signal mask round trip to the kernel as with swapcontext */
+void __task_switch(void **from, void *to);
+__asm__(
+    ".text\n"
+    ".globl __task_switch\n"
+    ".hidden __task_switch\n"
+    ".type __task_switch, @function\n"
+    "__task_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size __task_switch, .-__task_switch\n");
+
+static void __coro_prepare(task_coro_t *co)
 {
-    pthread_t *thread = handle;
+    void **sp = (void **)((char *)co->stack + TASK_STACK_SIZE);
 
-    return pthread_setschedprio(*thread, priority);
+    *--sp = NULL;                   /* __coro_entry never returns */
+    *--sp = (void *)__coro_entry;   /* popped by the first ret */
+    sp -= 6;
+    memset(sp, 0, 6 * sizeof(void *));
+    co->sp = sp;
+}
+
+static inline void __coro_enter(task_carrier_t *carrier, task_coro_t *co)
+{
+    __task_switch(&carrier->sp, co->sp);
+}
+
+static inline void __coro_leave(task_coro_t *co)
+{
+    __task_switch(&co->sp, co->carrier->sp);
+}
+#else
+static void __coro_prepare(task_coro_t *co)
+{
+    getcontext(&co->ctx);
+    co->ctx.uc_stack.ss_sp = co->stack;
+    co->ctx.uc_stack.ss_size = TASK_STACK_SIZE;
+    co->ctx.uc_link = NULL;
+    makecontext(&co->ctx, __coro_entry, 0);
+}
+
+static inline void __coro_enter(task_carrier_t *carrier, task_coro_t *co)
+{
+    swapcontext(&carrier->ctx, &co->ctx);
+}
+
+static inline void __coro_leave(task_coro_t *co)
+{
+    swapcontext(&co->ctx, &co->carrier->ctx);
+}
+#endif
+
+static void __coro_entry(void)
+{
+    task_coro_t *co = s_coro;
+
+    co->attr.routine(co->attr.arg);
+    co->done = 1;
+    __coro_leave(co);
+}
+
+static void __coro_free(task_coro_t *co)
+{
+    __stack_put(co->stack);
+    mem_free(co);
+}
+
+static void __carrier_backoff(task_carrier_t *carrier, long us)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += us * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&carrier->event, &carrier->lock, &ts);
+}
+
+static void *__carrier_run(void *arg)
+{
+    task_carrier_t *carrier = arg;
+    task_coro_t *co = NULL;
+    long backoff = TASK_IDLE_MIN_US;
+    int idle = 0;
+
+    pthread_mutex_lock(&carrier->lock);
+    while (carrier->n_coros) {
+        /* Every coroutine left is parked, nothing to run until one is woken */
+        if (list_empty(&carrier->ready)) {
+            pthread_cond_wait(&carrier->event, &carrier->lock);
+            continue;
+        }
+
+        co = list_entry(carrier->ready.next, task_coro_t, list);
+        list_del(&co->list);
+
+        if (co->cancel) {
+            carrier->n_coros--;
+            __coro_free(co);
+            continue;
+        }
+
+        carrier->current = co;
+        pthread_mutex_unlock(&carrier->lock);
+        co->idle = 0;
+        s_coro = co;
+        __coro_enter(carrier, co);
+        s_coro = NULL;
+        pthread_mutex_lock(&carrier->lock);
+        carrier->current = NULL;
+
+        if (co->done) {
+            carrier->n_coros--;
+            if (co->deleted) {
+                __coro_free(co);
+            }
+            idle = 0;
+            continue;
+        }
+        /* Already on the parked list, left there until task_unpark */
+        if (co->word) {
+            continue;
+        }
+        list_add_tail(&co->list, &carrier->ready);
+
+        /* Sleep a little once a whole round had nothing to do */
+        if (!co->idle) {
+            idle = 0;
+            backoff = TASK_IDLE_MIN_US;
+        } else if (++idle >= carrier->n_coros - carrier->n_parked) {
+            __carrier_backoff(carrier, backoff);
+            backoff = backoff * 2 > TASK_IDLE_MAX_US ? TASK_IDLE_MAX_US : backoff * 2;
+            idle = 0;
+        }
+    }
+    carrier->running = 0;
+    pthread_mutex_unlock(&carrier->lock);
+
+    return NULL;
+}
+
+static void __carrier_init(void)
+{
+    int i;
+    pthread_condattr_t condattr;
+
+    s_n_carriers = get_nprocs();
+    s_n_carriers = s_n_carriers < 1 ? 1 : s_n_carriers;
+    s_n_carriers = s_n_carriers > TASK_CARRIER_MAX ? TASK_CARRIER_MAX : s_n_carriers;
+
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    for (i = 0; i < s_n_carriers; i++) {
+        pthread_mutex_init(&s_carrier[i].lock, NULL);
+        pthread_cond_init(&s_carrier[i].event, &condattr);
+        INIT_LIST_HEAD(&s_carrier[i].ready);
+        INIT_LIST_HEAD(&s_carrier[i].parked);
+    }
+    pthread_condattr_destroy(&condattr);
+}
+
+static int __coro_create(task_attr_t *attr, void **handle)
+{
+    int status;
+    pthread_t thread;
+    task_carrier_t *carrier = NULL;
+    task_coro_t *new = NULL;
+
+    /* Carriers are shared by all coroutines, they cannot take per task settings */
+    if ((attr->cpumask && attr->cpumask != (size_t)(-1)) ||
+        attr->policy != SCHED_OTHER || attr->priority) {
+        errorf("coroutines only run with the default sched settings\n");
+        return -1;
+    }
+
+    pthread_once(&s_carrier_once, __carrier_init);
+
+    new = (task_coro_t *)mem_alloc(sizeof(task_coro_t));
+    if (new == NULL) {
+        errorf("mem_alloc err\n");
+        return -1;
+    }
+
+    memset(new, 0, sizeof(task_coro_t));
+    memcpy(&new->attr, attr, sizeof(task_attr_t));
+    new->stack = __stack_get();
+    if (new->stack == NULL) {
+        errorf("__stack_get err\n");
+        mem_free(new);
+        return -1;
+    }
+    __coro_prepare(new);
+
+    carrier = &s_carrier[__atomic_fetch_add(&s_next_carrier, 1, __ATOMIC_RELAXED) % s_n_carriers];
+    new->carrier = carrier;
+
+    pthread_mutex_lock(&carrier->lock);
+    list_add_tail(&new->list, &carrier->ready);
+    carrier->n_coros++;
+    if (carrier->running) {
+        pthread_cond_signal(&carrier->event);
+    } else {
+        status = pthread_create(&thread, NULL, __carrier_run, carrier);
+        if (status) {
+            list_del(&new->list);
+            carrier->n_coros--;
+            pthread_mutex_unlock(&carrier->lock);
+            errorf("pthread_create err\n");
+            __coro_free(new);
+            return -1;
+        }
+        pthread_detach(thread);
+        carrier->running = 1;
+    }
+    pthread_mutex_unlock(&carrier->lock);
+
+    *handle = new;
+    return 0;
+}
+
+static int __coro_delete(void *handle)
+{
+    task_coro_t *co = handle;
+    task_carrier_t *carrier = co->carrier;
+
+    pthread_mutex_lock(&carrier->lock);
+    co->deleted = 1;
+    if (co->done) {
+        __coro_free(co);
+    } else if (co->word && co != carrier->current) {
+        /* Never to be woken, drop it now and let the carrier see it gone */
+        list_del(&co->list);
+        carrier->n_parked--;
+        carrier->n_coros--;
+        __coro_free(co);
+        pthread_cond_signal(&carrier->event);
+    } else if (co != s_coro) {
+        /* Like a thread cancel, it is dropped at its next yield */
+        co->cancel = 1;
+    }
+    pthread_mutex_unlock(&carrier->lock);
+
+    return 0;
 }
 
 static task_func_t s_task_func[] = {
     [TASK_TYPE_THREAD] = {
         .create = __thread_create,
         .delete = __thread_delete,
-        .set_affinity = __thread_set_affinity,
-        .set_schedpolicy = __thread_set_schedpolicy,
-        .set_schedpriority = __thread_set_schedpriority,
+    },
+    [TASK_TYPE_COROUTINE] = {
+        .create = __coro_create,
+        .delete = __coro_delete,
     },
 };
 
@@ -114,7 +506,7 @@ int task_create(task_attr_t *attr, void **handle)
         return -1;
     }
 
-    memset(priv, sizeof(task_priv_t), 0);
+    memset(priv, 0, sizeof(task_priv_t));
     memcpy(&priv->attr, attr, sizeof(task_attr_t));
     priv->func = &s_task_func[attr->type];
 
@@ -157,41 +549,87 @@ int task_delete(void *handle)
     return 0;
 }
 
-int task_set_affinity(void *handle, size_t cpumask)
+int task_yield(int isidle)
 {
-    task_priv_t *priv = handle;
+    task_coro_t *co = s_coro;
 
-    if (handle == NULL) {
-        errorf("paramter err\n");
-        return -1;
+    if (co == NULL) {
+        return sched_yield();
     }
 
-    assert(priv->func->set_affinity);
-    return priv->func->set_affinity(priv->handle, cpumask);
+    co->idle = isidle;
+    __coro_leave(co);
+    return 0;
 }
 
-int task_set_schedpolicy(void *handle, int policy)
+int task_in_coroutine(void)
 {
-    task_priv_t *priv = handle;
+    return s_coro != NULL;
+}
 
-    if (handle == NULL) {
+int task_park(int *word, int val)
+{
+    task_coro_t *co = s_coro;
+    task_carrier_t *carrier = NULL;
+
+    if (co == NULL || word == NULL) {
         errorf("paramter err\n");
         return -1;
     }
 
-    assert(priv->func->set_schedpolicy);
-    return priv->func->set_schedpolicy(priv->handle, policy);
+    /* Checked under the lock task_unpark takes, a wake in between is not lost */
+    carrier = co->carrier;
+    pthread_mutex_lock(&carrier->lock);
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != val) {
+        pthread_mutex_unlock(&carrier->lock);
+        return 0;
+    }
+    co->word = word;
+    list_add_tail(&co->list, &carrier->parked);
+    carrier->n_parked++;
+    pthread_mutex_unlock(&carrier->lock);
+
+    __coro_leave(co);
+    return 0;
 }
 
-int task_set_schedpriority(void *handle, int priority)
+int task_unpark(int *word, int n)
 {
-    task_priv_t *priv = handle;
+    int i, woken = 0;
+    list_t *pos = NULL;
+    list_t *tmp = NULL;
+    task_carrier_t *carrier = NULL;
+    task_coro_t *co = NULL;
 
-    if (handle == NULL) {
+    if (word == NULL) {
         errorf("paramter err\n");
         return -1;
     }
 
-    assert(priv->func->set_schedpriority);
-    return priv->func->set_schedpriority(priv->handle, priority);
-}
\ No newline at end of file
+    /* No coroutine was ever created if the carriers are not set up */
+    for (i = 0; i < __atomic_load_n(&s_n_carriers, __ATOMIC_ACQUIRE) && woken < n; i++) {
+        carrier = &s_carrier[i];
+        pthread_mutex_lock(&carrier->lock);
+        list_for_each_safe(pos, tmp, &carrier->parked) {
+            co = list_entry(pos, task_coro_t, list);
+            if (woken >= n) {
+                break;
+            }
+            if (co->word != word) {
+                continue;
+            }
+            list_del(&co->list);
+            co->word = NULL;
+            carrier->n_parked--;
+            /* Still switching out, the carrier queues it once it is back */
+            if (co != carrier->current) {
+                list_add_tail(&co->list, &carrier->ready);
+                pthread_cond_signal(&carrier->event);
+            }
+            woken++;
+        }
+        pthread_mutex_unlock(&carrier->lock);
+    }
+
+    return woken;
+}
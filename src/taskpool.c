@@ -1,371 +1,2390 @@
 #include "taskpool.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
+#include <sys/sysinfo.h>
+#include <time.h>
 
+#include "deque.h"
+#include "futex.h"
 #include "log.h"
 #include "mem.h"
 #include "que.h"
 #include "task.h"
+#include "trace.h"
+#include "wheel.h"
 
 #define TASKPOOL_MAGIC (0xdeadbeef)
+#define TASKPOOL_SLOT_NUM (256)
+#define TASKPOOL_BATCH_MAX (16)
+#define TASKPOOL_GROUP_NUM (16)
+#define TASKPOOL_GROUP_NAME_LEN (32)
+#define TASKPOOL_SCALE_PERIOD_US (10000)
+#define TASKPOOL_RANGE_SPLIT (8)   /* pieces per thread with an automatic grain */
+#define TASKPOOL_CHUNK_BITS (12)
+#define TASKPOOL_CHUNK_SIZE (1 << TASKPOOL_CHUNK_BITS)
+#define TASKPOOL_CHUNK_NUM (1024)   /* up to 4M jobs alive at once */
+/* A job handle is the generation of its slot above the slot index + 1 */
+#define TASKPOOL_HANDLE_INDEX_BITS (24)
+#define TASKPOOL_HANDLE_INDEX_MASK (((uintptr_t)1 << TASKPOOL_HANDLE_INDEX_BITS) - 1)
 typedef void *handle_t;
 
-typedef struct {
-    size_t magic;
-    pthread_mutex_t lock;
-    pthread_cond_t event;
-    size_t n_total_jobs;
-    size_t n_done_jobs;
+/* Futex word taskpool_job_t.state, a taskpool_job_status_e and two flags */
+#define TASKPOOL_STATE_MASK (0xff)
+#define TASKPOOL_STATE_CLAIMED (0x100)  /* a worker took it, periodic ones keep it */
+#define TASKPOOL_STATE_WAITED (0x200)   /* somebody sleeps until it is final */
+
+/* Successor list of a job that has finished, nothing can be attached */
+#define TASKPOOL_EDGE_CLOSED ((taskpool_edge_t *)1)
+
+typedef struct taskpool_edge {
+    struct taskpool_edge *next;
+    struct taskpool_job *job;
+} taskpool_edge_t;
+
+/* One call of parallel_for or parallel_reduce */
+typedef struct taskpool_loop {
+    void *priv;
+    struct taskpool_group *group;   /* gets the pieces split off, NULL for none */
+    size_t grain;
+    size_t size;                    /* of a reduce value, 0 for a for loop */
+    const void *identity;           /* every piece starts from a copy of it */
+    void (*func)(size_t begin, size_t end, void *ctx);
+    void (*fold)(size_t begin, size_t end, void *value, void *ctx);
+    void (*join)(void *value, const void *other, void *ctx);
+    void *ctx;
+} taskpool_loop_t;
+
+/* Futex word taskpool_range_t.done */
+#define TASKPOOL_RANGE_DOING (0)
+#define TASKPOOL_RANGE_DONE (1)
+#define TASKPOOL_RANGE_WAITED (2)
+
+/* A piece of a loop, run by whoever claims it first */
+typedef struct taskpool_range {
+    taskpool_loop_t *loop;
+    struct taskpool_range *next;    /* pieces split off by the same runner */
+    size_t begin;
+    size_t end;
+    int taken;
+    int done;
+    int refs;                       /* the runner that split it and its job */
+    char value[];                   /* reduce only */
+} taskpool_range_t;
+
+/* Only the timed jobs and the scaled groups have one, on the wheel */
+typedef struct taskpool_timer {
+    wheel_link_t link;
+    struct taskpool_job *job;   /* NULL for the scaler of group */
+    struct taskpool_group *group;
+    uint64_t due;               /* monotonic us of the next run */
+    uint64_t period;            /* us between two runs, 0 for once */
+} taskpool_timer_t;
+
+/* What a worker touches to run a job sits in the first cache line */
+typedef struct taskpool_job {
+    que_link_t link;
+    int (*func)(void *arg);
+    void *arg;
+    struct taskpool_group *group;
+    int state;
+    int result;                 /* returned by func */
+    taskpool_edge_t *succ;      /* jobs waiting for this one */
+    taskpool_timer_t *timer;
+    uint64_t queued_ns;         /* monotonic ns it was queued at, timing only */
+    int n_deps;                 /* predecessors not done yet */
+    /* Kept across reuses of the slot */
+    unsigned int gen;           /* bumped by del_job and when the slot is freed */
+    unsigned int next;          /* index + 1 of the next free slot */
+    unsigned int index : 30;
+    unsigned int auto_free : 1;
+    unsigned int exit_worker : 1;
+} taskpool_job_t;
+
+typedef struct taskpool_group {
+    taskpool_group_attr_t attr;
+    char name[TASKPOOL_GROUP_NAME_LEN];
     handle_t jobs_todo;
-    handle_t jobs_keep;
-    handle_t workers[TASKPOOL_WORKER_TYPE_NONE];
-} taskpool_priv_t;
+    handle_t workers;
+    int n_workers;              /* created and not asked to exit yet */
+    int n_idle;                 /* waiting for a job */
+    int n_coro_idle;            /* coroutines of them, parked on coro_seq */
+    int coro_seq;               /* bumped by a put while coroutines are idle */
+    int timing;                 /* stamp the jobs queued, from taskpool_attr_t */
+    handle_t trace;             /* that of the pool, NULL when not tracing */
+    /* Autoscaling only */
+    taskpool_timer_t scaler;
+    uint64_t busy_since;        /* monotonic us the queue stayed non-empty from */
+    uint64_t idle_since;        /* monotonic us some worker stayed idle from */
+    /* TASKPOOL_SCHED_TYPE_STEAL only */
+    int nudge_pending;
+    taskpool_job_t nudge;
+} taskpool_group_t;
+
+/* Counters of one worker, written by it alone and read by get_stats */
+typedef struct {
+    size_t runs;
+    size_t completed;
+    size_t failed;
+    size_t cancelled;
+    size_t busy_ns;
+    size_t wait_ns[TASKPOOL_STATS_BUCKETS];
+    size_t run_ns[TASKPOOL_STATS_BUCKETS];
+} taskpool_shard_t;
 
 typedef struct {
     size_t magic;
-    taskpool_job_attr_t attr;
-    taskpool_job_status_t status;
+    taskpool_attr_t attr;
     pthread_mutex_t lock;
-    int auto_free;
-} taskpool_job_t;
+    int n_pending;          /* jobs added and not yet done or deleted */
+    int all_done_seq;       /* futex word, bumped when n_pending drops to 0 */
+    int n_all_waiters;
+    int stopping;               /* set by deinit, periodic jobs run once more */
+    int cancelling;             /* set by deinit, jobs not started are skipped */
+    int n_live;                 /* futex word, workers not returned yet */
+    int n_spinning;             /* idle workers spinning or yielding */
+    handle_t wheel;             /* created by the first timed job */
+    handle_t trace;             /* created with the pool if attr.trace_events */
+    size_t n_cancelled;         /* taken down by del_job alone */
+    /* Under lock */
+    list_t workers;             /* the running ones */
+    taskpool_shard_t retired;   /* counters of the workers gone */
+    /* Every job lives in a slot of these chunks, only deinit frees them */
+    taskpool_job_t *chunks[TASKPOOL_CHUNK_NUM];
+    size_t n_chunks;
+    uint64_t free_head;         /* ABA tag above the index + 1 of a free slot */
+    /* The first TASKPOOL_WORKER_TYPE_NONE ones are the default groups */
+    taskpool_group_t *groups[TASKPOOL_GROUP_NUM];
+    size_t n_groups;
+    /* TASKPOOL_SCHED_TYPE_STEAL only */
+    handle_t deques[TASKPOOL_SLOT_NUM];
+    taskpool_group_t *slot_group[TASKPOOL_SLOT_NUM];
+    int slot_used[TASKPOOL_SLOT_NUM];
+    size_t n_slots;
+} taskpool_priv_t;
 
 typedef struct {
+    que_link_t link;
     taskpool_worker_attr_t attr;
     taskpool_priv_t *info;
+    taskpool_group_t *group;
     taskpool_job_t *job;
     handle_t task;
+    handle_t deque;
+    size_t slot;
+    unsigned int seed;
+    list_t ready;               /* successors this worker runs itself */
+    int batch_head;
+    int batch_tail;
+    taskpool_job_t *batch[TASKPOOL_BATCH_MAX];
     int keep_alive;
+    list_t node;                /* in taskpool_priv_t.workers */
+    taskpool_shard_t stats;
 } taskpool_worker_t;
 
-static inline taskpool_priv_t *__get_priv(handle_t handle)
-{
-    taskpool_priv_t *priv;
+/* The worker running on the current thread, if any */
+static __thread taskpool_worker_t *s_worker;
+
+static const char *s_group_name[] = {
+    [TASKPOOL_WORKER_TYPE_THREAD] = "thread",
+    [TASKPOOL_WORKER_TYPE_COROUTINE] = "coroutine",
+};
+
+static inline taskpool_priv_t *__get_priv(handle_t handle)
+{
+    taskpool_priv_t *priv;
+
+    assert(handle);
+    priv = ((taskpool_t *)handle)->priv;
+    assert(priv);
+    assert(priv->magic == TASKPOOL_MAGIC);
+
+    return priv;
+}
+
+static inline taskpool_job_t *__job_slot(taskpool_priv_t *priv, size_t index)
+{
+    taskpool_job_t *chunk = __atomic_load_n(&priv->chunks[index >> TASKPOOL_CHUNK_BITS],
+                                            __ATOMIC_ACQUIRE);
+
+    return chunk + (index & (TASKPOOL_CHUNK_SIZE - 1));
+}
+
+static inline handle_t __job_handle(taskpool_job_t *job)
+{
+    uintptr_t gen = __atomic_load_n(&job->gen, __ATOMIC_RELAXED);
+
+    return (handle_t)((gen << TASKPOOL_HANDLE_INDEX_BITS) | (job->index + 1));
+}
+
+/* Return NULL for a handle whose job has been deleted since */
+static inline taskpool_job_t *__get_job(taskpool_priv_t *priv, handle_t handle)
+{
+    uintptr_t value = (uintptr_t)handle;
+    size_t index = value & TASKPOOL_HANDLE_INDEX_MASK;
+    taskpool_job_t *job = NULL;
+
+    if (index == 0 || --index >= __atomic_load_n(&priv->n_chunks, __ATOMIC_ACQUIRE) *
+                                     TASKPOOL_CHUNK_SIZE) {
+        return NULL;
+    }
+
+    /* The slot outlives the job, reading a stale one is safe */
+    job = __job_slot(priv, index);
+    if ((uintptr_t)__atomic_load_n(&job->gen, __ATOMIC_ACQUIRE) << TASKPOOL_HANDLE_INDEX_BITS !=
+        (value & ~TASKPOOL_HANDLE_INDEX_MASK)) {
+        return NULL;
+    }
+
+    return job;
+}
+
+static inline void __cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* Masks of 0 and of all ones both mean every cpu */
+static inline size_t __mask_norm(size_t mask)
+{
+    return mask ? mask : (size_t)(-1);
+}
+
+static inline uint64_t __now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Only the owner of a shard writes it, a plain add is enough */
+static inline void __stat_add(size_t *counter, size_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static inline void __stat_time(size_t *hist, uint64_t ns)
+{
+    int i = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    __stat_add(&hist[i < TASKPOOL_STATS_BUCKETS ? i : TASKPOOL_STATS_BUCKETS - 1], 1);
+}
+
+static void __stat_fold(taskpool_shard_t *sum, taskpool_shard_t *shard)
+{
+    int i;
+
+    sum->runs += __atomic_load_n(&shard->runs, __ATOMIC_RELAXED);
+    sum->completed += __atomic_load_n(&shard->completed, __ATOMIC_RELAXED);
+    sum->failed += __atomic_load_n(&shard->failed, __ATOMIC_RELAXED);
+    sum->cancelled += __atomic_load_n(&shard->cancelled, __ATOMIC_RELAXED);
+    sum->busy_ns += __atomic_load_n(&shard->busy_ns, __ATOMIC_RELAXED);
+    for (i = 0; i < TASKPOOL_STATS_BUCKETS; i++) {
+        sum->wait_ns[i] += __atomic_load_n(&shard->wait_ns[i], __ATOMIC_RELAXED);
+        sum->run_ns[i] += __atomic_load_n(&shard->run_ns[i], __ATOMIC_RELAXED);
+    }
+}
+
+static inline int __group_match(const taskpool_group_attr_t *attr, const taskpool_job_attr_t *job)
+{
+    return attr->type == job->type &&
+           __mask_norm(attr->sys_cpu_mask) == __mask_norm(job->sys_cpu_mask) &&
+           attr->sys_sched_policy == job->sys_sched_policy &&
+           attr->sys_sched_priority == job->sys_sched_priority;
+}
+
+/* Jobs go to the group already configured the way they ask for */
+static taskpool_group_t *__group_route(taskpool_priv_t *priv, const taskpool_job_attr_t *attr)
+{
+    size_t i;
+    size_t n = __atomic_load_n(&priv->n_groups, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n; i++) {
+        if (__group_match(&priv->groups[i]->attr, attr)) {
+            return priv->groups[i];
+        }
+    }
+
+    if (attr->type >= TASKPOOL_WORKER_TYPE_NONE) {
+        return priv->groups[TASKPOOL_WORKER_TYPE_THREAD];
+    }
+
+    return priv->groups[attr->type];
+}
+
+static taskpool_group_t *__group_find(taskpool_priv_t *priv, const taskpool_worker_attr_t *attr)
+{
+    size_t i;
+    size_t n = __atomic_load_n(&priv->n_groups, __ATOMIC_ACQUIRE);
+
+    if (attr->group == NULL) {
+        return attr->type < TASKPOOL_WORKER_TYPE_NONE ? priv->groups[attr->type] : NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (strcmp(priv->groups[i]->name, attr->group) == 0) {
+            return priv->groups[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void __group_delete(taskpool_group_t *group)
+{
+    if (group->jobs_todo) {
+        que_delete(group->jobs_todo);
+    }
+    if (group->workers) {
+        que_delete(group->workers);
+    }
+    mem_free(group);
+}
+
+static taskpool_group_t *__group_create(taskpool_priv_t *priv, const taskpool_group_attr_t *attr)
+{
+    const que_attr_t job_que_attr = {
+        .type = QUE_TYPE_INTRUSIVE,
+        .offset = offsetof(taskpool_job_t, link),
+        .levels = TASKPOOL_JOB_PRIORITY_NUM,
+        .aging = priv->attr.priority_aging,
+    };
+    const que_attr_t ring_que_attr = {
+        .type = QUE_TYPE_RING,
+        .capacity = priv->attr.queue_capacity,
+    };
+    const que_attr_t worker_que_attr = {
+        .type = QUE_TYPE_INTRUSIVE,
+        .offset = offsetof(taskpool_worker_t, link),
+    };
+
+    int status = 0;
+    taskpool_group_t *group = mem_alloc(sizeof(taskpool_group_t));
+    if (group == NULL) {
+        errorf("mem_alloc err\n");
+        return NULL;
+    }
+
+    memset(group, 0, sizeof(taskpool_group_t));
+    memcpy(&group->attr, attr, sizeof(taskpool_group_attr_t));
+    snprintf(group->name, sizeof(group->name), "%s", attr->name);
+    group->attr.name = group->name;
+    group->nudge.link.prio = TASKPOOL_JOB_PRIORITY_NUM - 1;
+    group->scaler.group = group;
+    group->timing = priv->attr.timing;
+    group->trace = priv->trace;
+
+    if (priv->attr.queue_type == TASKPOOL_QUEUE_TYPE_RING) {
+        status |= que_create_ex(&ring_que_attr, &group->jobs_todo);
+    } else {
+        status |= que_create_ex(&job_que_attr, &group->jobs_todo);
+    }
+    status |= que_create_ex(&worker_que_attr, &group->workers);
+    if (status) {
+        errorf("que_create err\n");
+        __group_delete(group);
+        return NULL;
+    }
+
+    return group;
+}
+
+/* Push a chain of slots, from first to last, on the free list */
+static void __job_push(taskpool_priv_t *priv, taskpool_job_t *first, taskpool_job_t *last)
+{
+    uint64_t head = __atomic_load_n(&priv->free_head, __ATOMIC_RELAXED);
+    uint64_t new;
+
+    do {
+        __atomic_store_n(&last->next, (unsigned int)head, __ATOMIC_RELAXED);
+        new = ((head >> 32) + 1) << 32 | (first->index + 1);
+    } while (!__atomic_compare_exchange_n(&priv->free_head, &head, new, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Add a chunk of slots, return -1 if the table is full */
+static int __job_grow(taskpool_priv_t *priv)
+{
+    size_t i;
+    taskpool_job_t *chunk = NULL;
+
+    pthread_mutex_lock(&priv->lock);
+    /* Somebody else may have grown it while we waited */
+    if ((unsigned int)__atomic_load_n(&priv->free_head, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_unlock(&priv->lock);
+        return 0;
+    }
+    if (priv->n_chunks == TASKPOOL_CHUNK_NUM) {
+        pthread_mutex_unlock(&priv->lock);
+        errorf("too many jobs\n");
+        return -1;
+    }
+
+    chunk = mem_alloc(TASKPOOL_CHUNK_SIZE * sizeof(taskpool_job_t));
+    if (chunk == NULL) {
+        pthread_mutex_unlock(&priv->lock);
+        errorf("mem_alloc err\n");
+        return -1;
+    }
+    memset(chunk, 0, TASKPOOL_CHUNK_SIZE * sizeof(taskpool_job_t));
+    for (i = 0; i < TASKPOOL_CHUNK_SIZE; i++) {
+        chunk[i].index = priv->n_chunks * TASKPOOL_CHUNK_SIZE + i;
+        chunk[i].next = chunk[i].index + 2;
+    }
+    __atomic_store_n(&priv->chunks[priv->n_chunks], chunk, __ATOMIC_RELEASE);
+    __atomic_store_n(&priv->n_chunks, priv->n_chunks + 1, __ATOMIC_RELEASE);
+    __job_push(priv, &chunk[0], &chunk[TASKPOOL_CHUNK_SIZE - 1]);
+    pthread_mutex_unlock(&priv->lock);
+
+    return 0;
+}
+
+/*
+ * Pop up to n free slots at once, return how many or -1 if the table is
+ * full. The tag in free_head moves on every push and pop, so a chain that
+ * changed while it was walked fails the CAS, and a recycled slot no ABA.
+ */
+static int __job_alloc_batch(taskpool_priv_t *priv, taskpool_job_t **jobs, int n)
+{
+    int i;
+    unsigned int next;
+    uint64_t head = __atomic_load_n(&priv->free_head, __ATOMIC_ACQUIRE);
+    uint64_t new;
+
+    while (1) {
+        if ((unsigned int)head == 0) {
+            if (__job_grow(priv)) {
+                return -1;
+            }
+            head = __atomic_load_n(&priv->free_head, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        next = (unsigned int)head;
+        for (i = 0; i < n && next; i++) {
+            jobs[i] = __job_slot(priv, next - 1);
+            next = __atomic_load_n(&jobs[i]->next, __ATOMIC_RELAXED);
+        }
+        new = ((head >> 32) + 1) << 32 | next;
+        if (__atomic_compare_exchange_n(&priv->free_head, &head, new, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return i;
+        }
+    }
+}
+
+static inline taskpool_job_t *__job_alloc(taskpool_priv_t *priv)
+{
+    taskpool_job_t *job = NULL;
+
+    return __job_alloc_batch(priv, &job, 1) == 1 ? job : NULL;
+}
+
+/* Give the slot back, the handles to it go stale */
+static void __job_free(taskpool_priv_t *priv, taskpool_job_t *job)
+{
+    mem_free(job->timer);
+    job->timer = NULL;
+    __atomic_fetch_add(&job->gen, 1, __ATOMIC_RELEASE);
+    __job_push(priv, job, job);
+}
+
+static inline int __job_final(int state)
+{
+    return (state & TASKPOOL_STATE_MASK) >= TASKPOOL_JOB_STATUS_DONE;
+}
+
+/* Take the job to run it, return 0 if del_job has cancelled it first */
+static int __job_claim(taskpool_job_t *job)
+{
+    int val = __atomic_load_n(&job->state, __ATOMIC_ACQUIRE);
+
+    do {
+        if (__job_final(val)) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&job->state, &val,
+                                          (val & TASKPOOL_STATE_WAITED) |
+                                          TASKPOOL_STATE_CLAIMED | TASKPOOL_JOB_STATUS_DOING,
+                                          0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return 1;
+}
+
+/* Mark a job nobody took yet as cancelled, return 0 on success */
+static int __job_cancel(taskpool_job_t *job)
+{
+    int val = __atomic_load_n(&job->state, __ATOMIC_ACQUIRE);
+
+    do {
+        if (val & TASKPOOL_STATE_CLAIMED || __job_final(val)) {
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&job->state, &val, TASKPOOL_JOB_STATUS_CANCELED,
+                                          0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    if (val & TASKPOOL_STATE_WAITED) {
+        futex_wake(&job->state, INT_MAX);
+    }
+
+    return 0;
+}
+
+/* Move a job its worker holds to a new status, waking the waiters if final */
+static void __job_set(taskpool_job_t *job, int status)
+{
+    int val = __atomic_load_n(&job->state, __ATOMIC_RELAXED);
+    int new;
+
+    do {
+        new = (val & TASKPOOL_STATE_CLAIMED) | status;
+        if (!__job_final(status)) {
+            new |= val & TASKPOOL_STATE_WAITED;
+        }
+    } while (!__atomic_compare_exchange_n(&job->state, &val, new, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if (__job_final(status) && (val & TASKPOOL_STATE_WAITED)) {
+        futex_wake(&job->state, INT_MAX);
+    }
+}
+
+/* Sleep on the job itself, nobody else is woken when it is done */
+static void __job_wait(taskpool_job_t *job)
+{
+    int val;
+
+    while (!__job_final(val = __atomic_load_n(&job->state, __ATOMIC_ACQUIRE))) {
+        if (task_in_coroutine()) {
+            task_yield(1);
+            continue;
+        }
+        if (!(val & TASKPOOL_STATE_WAITED) &&
+            !__atomic_compare_exchange_n(&job->state, &val, val | TASKPOOL_STATE_WAITED, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        futex_wait(&job->state, val | TASKPOOL_STATE_WAITED);
+    }
+}
+
+static inline void __pending_add(taskpool_priv_t *priv, int n)
+{
+    __atomic_fetch_add(&priv->n_pending, n, __ATOMIC_SEQ_CST);
+}
+
+/* Only the drop to zero wakes the wait_all_jobs_done callers */
+static void __pending_sub(taskpool_priv_t *priv, int n)
+{
+    if (__atomic_sub_fetch(&priv->n_pending, n, __ATOMIC_SEQ_CST) == 0) {
+        __atomic_fetch_add(&priv->all_done_seq, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&priv->n_all_waiters, __ATOMIC_SEQ_CST)) {
+            futex_wake(&priv->all_done_seq, INT_MAX);
+        }
+    }
+}
+
+static void __pending_wait(taskpool_priv_t *priv)
+{
+    int seq;
+
+    while (1) {
+        /* Read the sequence first, a drop after the check then changes it */
+        seq = __atomic_load_n(&priv->all_done_seq, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&priv->n_pending, __ATOMIC_SEQ_CST) == 0) {
+            break;
+        }
+        if (task_in_coroutine()) {
+            task_yield(1);
+            continue;
+        }
+        __atomic_fetch_add(&priv->n_all_waiters, 1, __ATOMIC_SEQ_CST);
+        futex_wait(&priv->all_done_seq, seq);
+        __atomic_fetch_sub(&priv->n_all_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* Wait until every worker has returned for good, the exited ones included */
+static void __live_wait(taskpool_priv_t *priv)
+{
+    int n;
+
+    while ((n = __atomic_load_n(&priv->n_live, __ATOMIC_ACQUIRE)) != 0) {
+        futex_wait(&priv->n_live, n);
+    }
+}
+
+/* Return 0 if the predecessor is done already and nothing was attached */
+static int __edge_attach(taskpool_job_t *job, taskpool_edge_t *edge)
+{
+    taskpool_edge_t *head = __atomic_load_n(&job->succ, __ATOMIC_ACQUIRE);
+
+    do {
+        if (head == TASKPOOL_EDGE_CLOSED) {
+            return 0;
+        }
+        edge->next = head;
+    } while (!__atomic_compare_exchange_n(&job->succ, &head, edge, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    return 1;
+}
+
+static int __job_submit(taskpool_group_t *group, taskpool_job_t **jobs, int n);
+static int __worker_add(taskpool_priv_t *priv, taskpool_group_t *group,
+                        const taskpool_worker_attr_t *attr);
+static int __range_job(void *arg);
+static void __range_put(taskpool_range_t *range);
+
+static void __job_ready(taskpool_worker_t *worker, taskpool_job_t *job)
+{
+    /* The first one runs next on this very worker without a queue trip */
+    if (worker && worker->group == job->group) {
+        if (list_empty(&worker->ready) || __job_submit(job->group, &job, 1) != 1) {
+            if (job->group->timing) {
+                job->queued_ns = __now_ns();
+            }
+            if (job->group->trace) {
+                trace_event(job->group->trace, TRACE_EVENT_ENQUEUE, job, job->func, 0);
+            }
+            list_add_tail(&job->link.list, &worker->ready);
+        }
+        return;
+    }
+
+    /* A full ring drains as the workers of that group go on */
+    while (__job_submit(job->group, &job, 1) != 1) {
+        task_yield(0);
+    }
+}
+
+/* Close the successor list of a job, return the edges attached so far */
+static inline taskpool_edge_t *__succ_take(taskpool_job_t *job)
+{
+    return __atomic_exchange_n(&job->succ, TASKPOOL_EDGE_CLOSED, __ATOMIC_ACQ_REL);
+}
+
+/* Dispatch the successors whose last predecessor was the job they came from */
+static void __succ_release(taskpool_worker_t *worker, taskpool_edge_t *edge)
+{
+    taskpool_edge_t *next = NULL;
+
+    for (; edge; edge = next) {
+        next = edge->next;
+        if (__atomic_sub_fetch(&edge->job->n_deps, 1, __ATOMIC_ACQ_REL) == 0) {
+            __job_ready(worker, edge->job);
+        }
+        mem_free(edge);
+    }
+}
+
+static void __slot_claim(taskpool_worker_t *worker)
+{
+    size_t i;
+    taskpool_priv_t *priv = worker->info;
+
+    pthread_mutex_lock(&priv->lock);
+    for (i = 0; i < TASKPOOL_SLOT_NUM; i++) {
+        if (priv->slot_used[i]) {
+            continue;
+        }
+        /* Deques outlive their workers so thieves never see one freed */
+        if (priv->deques[i] == NULL && deque_create(&priv->deques[i])) {
+            errorf("deque_create err\n");
+            break;
+        }
+        priv->slot_used[i] = 1;
+        __atomic_store_n(&priv->slot_group[i], worker->group, __ATOMIC_RELEASE);
+        worker->slot = i;
+        worker->deque = priv->deques[i];
+        if (priv->n_slots < i + 1) {
+            __atomic_store_n(&priv->n_slots, i + 1, __ATOMIC_RELEASE);
+        }
+        break;
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    if (worker->deque == NULL) {
+        warnf("worker %p has no deque, it only takes shared jobs\n", worker);
+    }
+}
+
+/* Idle coroutines park on their carrier, not in que_get, so a put wakes them here */
+static void __coro_kick(taskpool_group_t *group, int n)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&group->n_coro_idle, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&group->coro_seq, 1, __ATOMIC_SEQ_CST);
+        task_unpark(&group->coro_seq, n);
+    }
+}
+
+/* The deque is left empty by __worker_flush, only its owner pushes to it */
+static void __slot_release(taskpool_worker_t *worker)
+{
+    taskpool_priv_t *priv = worker->info;
+
+    if (worker->deque == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&priv->lock);
+    priv->slot_used[worker->slot] = 0;
+    pthread_mutex_unlock(&priv->lock);
+    worker->deque = NULL;
+}
+
+static void __nudge(taskpool_group_t *group)
+{
+    /* Wake one parked worker so it goes looking for jobs to steal */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&group->n_idle, __ATOMIC_RELAXED) &&
+        !__atomic_exchange_n(&group->nudge_pending, 1, __ATOMIC_ACQ_REL)) {
+        if (que_put(group->jobs_todo, &group->nudge)) {
+            __atomic_store_n(&group->nudge_pending, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+static taskpool_job_t *__steal_job(taskpool_worker_t *worker)
+{
+    size_t i, victim;
+    taskpool_priv_t *priv = worker->info;
+    size_t n = __atomic_load_n(&priv->n_slots, __ATOMIC_ACQUIRE);
+    handle_t deque = NULL;
+    taskpool_job_t *job = NULL;
+
+    for (i = 0; i < 2 * n; i++) {
+        victim = rand_r(&worker->seed) % n;
+        deque = __atomic_load_n(&priv->deques[victim], __ATOMIC_ACQUIRE);
+        if (deque == NULL || deque == worker->deque ||
+            __atomic_load_n(&priv->slot_group[victim], __ATOMIC_ACQUIRE) != worker->group) {
+            continue;
+        }
+        if (deque_steal(deque, (handle_t *)&job) == 0) {
+            tracef("worker %p stole job %p from slot %zu\n", worker, job, victim);
+            if (worker->group->trace) {
+                trace_event(worker->group->trace, TRACE_EVENT_STEAL, job, job->func, victim);
+            }
+            if (deque_len(deque)) {
+                __nudge(worker->group);
+            }
+            return job;
+        }
+    }
+
+    return NULL;
+}
+
+static int __has_stealable(taskpool_worker_t *worker)
+{
+    size_t i;
+    taskpool_priv_t *priv = worker->info;
+    size_t n = __atomic_load_n(&priv->n_slots, __ATOMIC_ACQUIRE);
+    handle_t deque = NULL;
+
+    for (i = 0; i < n; i++) {
+        deque = __atomic_load_n(&priv->deques[i], __ATOMIC_ACQUIRE);
+        if (deque && deque != worker->deque && deque_len(deque) &&
+            __atomic_load_n(&priv->slot_group[i], __ATOMIC_ACQUIRE) == worker->group) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Wait a little for work before parking, parking costs the next job a
+ * futex wake and a context switch. Return 1 if work showed up meanwhile,
+ * 0 if the worker should park now.
+ */
+static int __idle_wait(taskpool_worker_t *worker)
+{
+    int i, found = 0;
+    taskpool_priv_t *priv = worker->info;
+    taskpool_group_t *group = worker->group;
+
+    if (priv->attr.idle_spin <= 0 && priv->attr.idle_yield <= 0) {
+        return 0;
+    }
+
+    /* Bound the cpus burnt by idle workers, the others park right away */
+    if (__atomic_add_fetch(&priv->n_spinning, 1, __ATOMIC_RELAXED) > priv->attr.idle_spinners) {
+        __atomic_sub_fetch(&priv->n_spinning, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    for (i = 0; i < priv->attr.idle_spin + priv->attr.idle_yield; i++) {
+        if (que_len(group->jobs_todo) > 0 ||
+            (worker->deque && __has_stealable(worker))) {
+            found = 1;
+            break;
+        }
+        if (i < priv->attr.idle_spin) {
+            __cpu_relax();
+        } else {
+            sched_yield();
+        }
+    }
+    __atomic_sub_fetch(&priv->n_spinning, 1, __ATOMIC_RELAXED);
+
+    return found;
+}
+
+/* Take a share of the shared backlog, deeper queues give bigger batches */
+static int __fetch_batch(taskpool_worker_t *worker, taskpool_job_t **job, int isblock)
+{
+    int i, n, k, m;
+    taskpool_group_t *group = worker->group;
+    int workers = __atomic_load_n(&group->n_workers, __ATOMIC_RELAXED);
+
+    k = que_len(group->jobs_todo) / (workers > 0 ? workers : 1);
+    k = k < 1 ? 1 : k > TASKPOOL_BATCH_MAX ? TASKPOOL_BATCH_MAX : k;
+
+    do {
+        n = que_get_batch(group->jobs_todo, (handle_t *)worker->batch, k, isblock);
+        for (i = 0, m = 0; i < n; i++) {
+            if (worker->batch[i] == &group->nudge) {
+                __atomic_store_n(&group->nudge_pending, 0, __ATOMIC_RELEASE);
+                continue;
+            }
+            worker->batch[m++] = worker->batch[i];
+        }
+        /* Woken by a nudge alone, a worker without a deque has nothing to steal */
+    } while (m == 0 && n > 0 && isblock && worker->deque == NULL);
+    if (m == 0) {
+        return -1;
+    }
+    k = m;
+
+    *job = worker->batch[0];
+    worker->batch_head = 1;
+    worker->batch_tail = k;
+
+    if (worker->deque) {
+        /* Leave the rest where thieves can reach them */
+        for (i = k - 1; i > 0; i--) {
+            if (deque_push(worker->deque, worker->batch[i])) {
+                break;
+            }
+        }
+        worker->batch_tail = i + 1;
+    }
+
+    return 0;
+}
+
+/* Put the jobs taken ahead back in front, return -1 if some could not be */
+static int __batch_release(taskpool_worker_t *worker)
+{
+    while (worker->batch_tail > worker->batch_head) {
+        if (que_put_to_head(worker->group->jobs_todo, worker->batch[worker->batch_tail - 1])) {
+            errorf("que_put_to_head err\n");
+            return -1;
+        }
+        worker->batch_tail--;
+        __coro_kick(worker->group, 1);
+    }
+
+    return 0;
+}
+
+/* A job taken ahead waits if a higher level has been queued since */
+static inline int __job_outranked(taskpool_worker_t *worker, taskpool_job_t *job)
+{
+    return que_level(worker->group->jobs_todo) > job->link.prio;
+}
+
+/* A B/E span would nest with the jobs of the other coroutines on the carrier */
+static inline void __trace_job(taskpool_worker_t *worker, trace_event_e type,
+                               taskpool_job_t *job, int arg)
+{
+    if (worker->attr.type == TASKPOOL_WORKER_TYPE_COROUTINE) {
+        type = type == TRACE_EVENT_START ? TRACE_EVENT_CORO_START : TRACE_EVENT_CORO_END;
+    }
+    trace_event(worker->group->trace, type, job, job->func, arg);
+}
+
+static inline void __trace_park(taskpool_worker_t *worker, trace_event_e type)
+{
+    if (worker->group->trace == NULL) {
+        return;
+    }
+
+    if (worker->attr.type == TASKPOOL_WORKER_TYPE_COROUTINE) {
+        type = type == TRACE_EVENT_PARK ? TRACE_EVENT_CORO_PARK : TRACE_EVENT_CORO_UNPARK;
+        trace_event(worker->group->trace, type, worker, NULL, 0);
+        return;
+    }
+    trace_event(worker->group->trace, type, NULL, NULL, 0);
+}
+
+static int __next_job(taskpool_worker_t *worker, taskpool_job_t **job)
+{
+    int status, seq;
+    taskpool_group_t *group = worker->group;
+
+    if (!list_empty(&worker->ready)) {
+        *job = list_entry(worker->ready.next, taskpool_job_t, link.list);
+        list_del(&(*job)->link.list);
+        return 0;
+    }
+
+    if (worker->batch_head < worker->batch_tail) {
+        /* Run in order after all if the queue cannot take them back */
+        if (!__job_outranked(worker, worker->batch[worker->batch_head]) ||
+            __batch_release(worker)) {
+            *job = worker->batch[worker->batch_head++];
+            return 0;
+        }
+    }
+
+    if (worker->attr.type == TASKPOOL_WORKER_TYPE_COROUTINE) {
+        if (__fetch_batch(worker, job, 0) == 0) {
+            return 0;
+        }
+        /* Park the coroutine alone, the carrier thread goes on with the others */
+        __atomic_fetch_add(&group->n_idle, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&group->n_coro_idle, 1, __ATOMIC_SEQ_CST);
+        __trace_park(worker, TRACE_EVENT_PARK);
+        while (1) {
+            /* Read the sequence first, a put after the fetch then changes it */
+            seq = __atomic_load_n(&group->coro_seq, __ATOMIC_SEQ_CST);
+            if (__fetch_batch(worker, job, 0) == 0) {
+                break;
+            }
+            task_park(&group->coro_seq, seq);
+        }
+        __trace_park(worker, TRACE_EVENT_UNPARK);
+        __atomic_fetch_sub(&group->n_coro_idle, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&group->n_idle, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    if (worker->deque == NULL) {
+        while (__idle_wait(worker)) {
+            if (__fetch_batch(worker, job, 0) == 0) {
+                return 0;
+            }
+        }
+        __atomic_fetch_add(&group->n_idle, 1, __ATOMIC_RELAXED);
+        __trace_park(worker, TRACE_EVENT_PARK);
+        status = __fetch_batch(worker, job, 1);
+        __trace_park(worker, TRACE_EVENT_UNPARK);
+        __atomic_fetch_sub(&group->n_idle, 1, __ATOMIC_RELAXED);
+        return status;
+    }
+
+    /* Own deque first, then random victims, then the shared queue */
+    while (1) {
+        if (deque_pop(worker->deque, (handle_t *)job) == 0) {
+            /* A higher level waits in the shared queue, go there unless it is full */
+            if (!__job_outranked(worker, *job) ||
+                que_put_to_head(group->jobs_todo, *job)) {
+                return 0;
+            }
+            __coro_kick(group, 1);
+            if (__fetch_batch(worker, job, 0) == 0) {
+                return 0;
+            }
+            continue;
+        }
+
+        *job = __steal_job(worker);
+        if (*job) {
+            return 0;
+        }
+
+        if (__fetch_batch(worker, job, 0) == 0) {
+            return 0;
+        }
+
+        if (__idle_wait(worker)) {
+            continue;
+        }
+
+        /* Announce ourselves before the last look so pushers nudge us */
+        __atomic_fetch_add(&group->n_idle, 1, __ATOMIC_SEQ_CST);
+        if (!__has_stealable(worker)) {
+            __trace_park(worker, TRACE_EVENT_PARK);
+            status = __fetch_batch(worker, job, 1);
+            __trace_park(worker, TRACE_EVENT_UNPARK);
+            if (status == 0) {
+                __atomic_fetch_sub(&group->n_idle, 1, __ATOMIC_RELAXED);
+                return 0;
+            }
+        }
+        __atomic_fetch_sub(&group->n_idle, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Ask one worker of the group to exit, without waiting for it */
+static int __worker_retire(taskpool_group_t *group)
+{
+    taskpool_job_t *pill = mem_alloc(sizeof(taskpool_job_t));
+    if (pill == NULL) {
+        errorf("mem_alloc err\n");
+        return -1;
+    }
+    memset(pill, 0, sizeof(taskpool_job_t));
+    pill->link.prio = TASKPOOL_JOB_PRIORITY_NUM - 1;
+    pill->exit_worker = 1;
+    pill->auto_free = 1;
+
+    __atomic_fetch_sub(&group->n_workers, 1, __ATOMIC_RELAXED);
+    if (que_put_to_head(group->jobs_todo, pill)) {
+        errorf("que_put_to_head err\n");
+        __atomic_fetch_add(&group->n_workers, 1, __ATOMIC_RELAXED);
+        mem_free(pill);
+        return -1;
+    }
+    __coro_kick(group, 1);
+
+    return 0;
+}
+
+/* Run on the wheel thread every TASKPOOL_SCALE_PERIOD_US, never blocks */
+static void __group_scale(taskpool_priv_t *priv, taskpool_group_t *group)
+{
+    const taskpool_worker_attr_t attr = {
+        .type = group->attr.type,
+        .group = group->name,
+    };
+    const taskpool_group_attr_t *scale = &group->attr;
+    uint64_t now = wheel_now();
+    int depth = que_len(group->jobs_todo);
+    int n = __atomic_load_n(&group->n_workers, __ATOMIC_RELAXED);
+    /* Jobs with no worker at all never wait for a threshold */
+    int grow = n < scale->min_workers || (n == 0 && depth);
+
+    group->busy_since = depth == 0 ? 0 : group->busy_since ? group->busy_since : now;
+    if (scale->scale_depth > 0 && depth > scale->scale_depth * n) {
+        grow = 1;
+    }
+    if (scale->scale_wait_ms > 0 && group->busy_since &&
+        now - group->busy_since >= (uint64_t)scale->scale_wait_ms * 1000) {
+        grow = 1;
+    }
+
+    if (grow && n < scale->max_workers) {
+        if (__worker_add(priv, group, &attr)) {
+            errorf("__worker_add err\n");
+        }
+        /* The newcomer gets a full wait before the next one is added */
+        group->busy_since = depth ? now : 0;
+        group->idle_since = 0;
+    } else if (__atomic_load_n(&group->n_idle, __ATOMIC_RELAXED) == 0 || depth) {
+        group->idle_since = 0;
+    } else if (group->idle_since == 0) {
+        group->idle_since = now;
+    } else if (scale->idle_timeout_ms > 0 && n > scale->min_workers &&
+               now - group->idle_since >= (uint64_t)scale->idle_timeout_ms * 1000) {
+        if (__worker_retire(group)) {
+            errorf("__worker_retire err\n");
+        }
+        group->idle_since = now;
+    }
+
+    /* Keeps going while deinit drains, until the wheel is deleted */
+    group->scaler.due = now + TASKPOOL_SCALE_PERIOD_US;
+    if (wheel_add(priv->wheel, &group->scaler, group->scaler.due)) {
+        errorf("wheel_add err\n");
+    }
+}
+
+/* The wheel thread moves due jobs into their queues, one batch per group */
+static void __timer_expire(void *arg, void **elements, int n)
+{
+    int i, run, queued;
+    taskpool_timer_t *timer = NULL;
+    taskpool_job_t **jobs = (taskpool_job_t **)elements;
+
+    /* Scale the groups first, the jobs take the room of their timers */
+    for (i = 0, run = 0; i < n; i++) {
+        timer = elements[i];
+        if (timer->job == NULL) {
+            __group_scale(arg, timer->group);
+        } else {
+            jobs[run++] = timer->job;
+        }
+    }
+
+    for (n = run, i = 0; i < n; i += run) {
+        for (run = 1; i + run < n && jobs[i + run]->group == jobs[i]->group; run++) {
+        }
+        queued = __job_submit(jobs[i]->group, jobs + i, run);
+        for (queued = queued > 0 ? queued : 0; queued < run; queued++) {
+            __job_ready(NULL, jobs[i + queued]);
+        }
+    }
+}
+
+/* The wheel and its thread come with the first timed job or scaled group */
+static handle_t __wheel_get(taskpool_priv_t *priv)
+{
+    const wheel_attr_t wheel_attr = {
+        .offset = offsetof(taskpool_timer_t, link),
+        .expire = __timer_expire,
+        .arg = priv,
+    };
+
+    handle_t wheel = __atomic_load_n(&priv->wheel, __ATOMIC_ACQUIRE);
+
+    if (wheel == NULL) {
+        pthread_mutex_lock(&priv->lock);
+        if (priv->wheel == NULL && wheel_create(&wheel_attr, &wheel) == 0) {
+            __atomic_store_n(&priv->wheel, wheel, __ATOMIC_RELEASE);
+        }
+        wheel = priv->wheel;
+        pthread_mutex_unlock(&priv->lock);
+    }
+
+    return wheel;
+}
+
+/* Put a periodic job back on the wheel, return 0 if it is finished instead */
+static int __job_rearm(taskpool_priv_t *priv, taskpool_job_t *job, int result)
+{
+    uint64_t now, next;
+    taskpool_timer_t *timer = job->timer;
+    uint64_t period = timer ? __atomic_load_n(&timer->period, __ATOMIC_SEQ_CST) : 0;
+
+    if (period == 0 || __atomic_load_n(&priv->stopping, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    /* Still claimed, so del_job cannot mark it cancelled behind our back */
+    __atomic_store_n(&job->result, result, __ATOMIC_RELAXED);
+    __job_set(job, TASKPOOL_JOB_STATUS_TODO);
+
+    /* Keep the rate, the runs missed while late are coalesced into one */
+    now = wheel_now();
+    next = timer->due + period;
+    if (next <= now) {
+        next += ((now - next) / period + 1) * period;
+    }
+    timer->due = next;
+    if (wheel_add(priv->wheel, timer, next)) {
+        errorf("wheel_add err\n");
+        return 0;
+    }
+
+    /*
+     * del_job may have stopped it meanwhile, whoever cancels it retires it.
+     * So does deinit, its flush may have come before this add.
+     */
+    if ((__atomic_load_n(&timer->period, __ATOMIC_SEQ_CST) == 0 ||
+         __atomic_load_n(&priv->stopping, __ATOMIC_ACQUIRE)) &&
+        wheel_cancel(priv->wheel, timer) == 0) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/* A job that never runs lets go of what its arg holds */
+static inline void __job_drop(taskpool_job_t *job)
+{
+    /* Its runner does the piece of a loop instead, once it finds it unclaimed */
+    if (job->func == __range_job) {
+        __range_put(job->arg);
+    }
+}
+
+/* Run a job the worker has taken, or drop it if del_job got to it first */
+static void __job_run(taskpool_worker_t *worker, taskpool_job_t *job)
+{
+    int status, state;
+    uint64_t start = 0;
+    taskpool_priv_t *priv = worker->info;
+    taskpool_shard_t *stats = &worker->stats;
+    taskpool_edge_t *edge = NULL;
+
+    worker->job = job;
+    if (!__job_claim(job)) {
+        /* Deleted while queued, nobody else holds it any more */
+        __stat_add(&stats->cancelled, 1);
+        __job_drop(job);
+        __succ_release(worker, __succ_take(job));
+        __job_free(priv, job);
+        worker->job = NULL;
+        __pending_sub(priv, 1);
+        return;
+    }
+
+    if (__atomic_load_n(&priv->cancelling, __ATOMIC_RELAXED)) {
+        /* Completed without running, so its successors go the same way */
+        status = 0;
+        state = TASKPOOL_JOB_STATUS_CANCELED;
+        __stat_add(&stats->cancelled, 1);
+        __job_drop(job);
+    } else {
+        if (worker->group->timing) {
+            start = __now_ns();
+            __stat_time(stats->wait_ns, start - job->queued_ns);
+        }
+        if (worker->group->trace) {
+            __trace_job(worker, TRACE_EVENT_START, job, 0);
+        }
+        tracef("worker %p is doing job %p ...\n", worker, job);
+        status = job->func(job->arg);
+        tracef("worker %p finish job %p\n", worker, job);
+        if (worker->group->trace) {
+            __trace_job(worker, TRACE_EVENT_END, job, status);
+        }
+        if (worker->group->timing) {
+            start = __now_ns() - start;
+            __stat_add(&stats->busy_ns, start);
+            __stat_time(stats->run_ns, start);
+        }
+        __stat_add(&stats->runs, 1);
+        __stat_add(&stats->failed, status != 0);
+        if (__job_rearm(priv, job, status)) {
+            worker->job = NULL;
+            return;
+        }
+        state = TASKPOOL_JOB_STATUS_DONE;
+        __stat_add(&stats->completed, 1);
+    }
+    /* Closed before it is seen final, del_job may free it right then */
+    edge = __succ_take(job);
+    if (job->auto_free) {
+        __job_free(priv, job);
+    } else {
+        __atomic_store_n(&job->result, status, __ATOMIC_RELAXED);
+        __job_set(job, state);
+    }
+    worker->job = NULL;
+    /* So a successor always finds its predecessor done with its result */
+    __succ_release(worker, edge);
+    __pending_sub(priv, 1);
+}
+
+/*
+ * Run what the worker took ahead, or left in its deque, before it exits.
+ * Putting it back could fail, and the pending count would then never drop
+ * to zero.
+ */
+static void __worker_flush(taskpool_worker_t *worker)
+{
+    taskpool_job_t *job = NULL;
+
+    while (1) {
+        if (!list_empty(&worker->ready)) {
+            job = list_entry(worker->ready.next, taskpool_job_t, link.list);
+            list_del(&job->link.list);
+        } else if (worker->batch_head < worker->batch_tail) {
+            job = worker->batch[worker->batch_head++];
+        } else if (worker->deque == NULL || deque_pop(worker->deque, (handle_t *)&job)) {
+            break;
+        }
+
+        /* The pill of another worker, the head of a queue is never full */
+        if (job->exit_worker) {
+            while (que_put_to_head(worker->group->jobs_todo, job)) {
+                errorf("que_put_to_head err\n");
+                task_yield(0);
+            }
+            __coro_kick(worker->group, 1);
+            continue;
+        }
+        __job_run(worker, job);
+    }
+}
+
+static void *__do_task(void *arg)
+{
+    int status;
+    taskpool_worker_t *worker = arg;
+    taskpool_priv_t *priv = worker->info;
+    taskpool_job_t *job = NULL;
+    taskpool_job_t *pill = NULL;
+
+    /* Coroutines share their carrier thread, only threads own a deque */
+    if (worker->attr.type == TASKPOOL_WORKER_TYPE_THREAD) {
+        s_worker = worker;
+        if (worker->info->attr.sched_type == TASKPOOL_SCHED_TYPE_STEAL) {
+            __slot_claim(worker);
+        }
+    }
+
+    status = que_put(worker->group->workers, worker);
+    assert(!status);
+    pthread_mutex_lock(&priv->lock);
+    list_add_tail(&worker->node, &priv->workers);
+    pthread_mutex_unlock(&priv->lock);
+    if (worker->group->trace) {
+        trace_name(worker->group->trace, worker->group->name);
+    }
+    tracef("worker %p start\n", worker);
+
+    worker->keep_alive = 1;
+    while (worker->keep_alive) {
+        status = __next_job(worker, &job);
+        if (status || job->exit_worker) {
+            pill = status ? NULL : job;
+            worker->keep_alive = 0;
+            if (pill == NULL) {
+                /* Nobody asked, the sender of a pill does the count */
+                __atomic_fetch_sub(&worker->group->n_workers, 1, __ATOMIC_RELAXED);
+            }
+            __worker_flush(worker);
+            __slot_release(worker);
+            status = que_remove(worker->group->workers, worker);
+            assert(!status);
+            /* Gone from get_stats before del_worker returns */
+            pthread_mutex_lock(&priv->lock);
+            list_del(&worker->node);
+            __stat_fold(&priv->retired, &worker->stats);
+            pthread_mutex_unlock(&priv->lock);
+            if (pill && pill->auto_free) {
+                mem_free(pill);
+            } else if (pill) {
+                /* del_worker owns the record and frees it once woken */
+                __job_set(pill, TASKPOOL_JOB_STATUS_DONE);
+            }
+            break;
+        }
+
+        __job_run(worker, job);
+    }
+
+    tracef("worker %p end\n", worker);
+    if (s_worker == worker) {
+        s_worker = NULL;
+    }
+    task_delete(worker->task);
+    mem_free(worker);
+
+    /* Last touch of the pool, deinit may free it as soon as it sees 0 */
+    if (__atomic_sub_fetch(&priv->n_live, 1, __ATOMIC_RELEASE) == 0) {
+        futex_wake(&priv->n_live, INT_MAX);
+    }
+    return NULL;
+}
+
+static int taskpool_deinit(taskpool_t *self)
+{
+    tracef("\n");
+
+    size_t i;
+    taskpool_priv_t *priv = __get_priv(self);
+    taskpool_group_t *group = NULL;
+
+    __atomic_store_n(&priv->stopping, 1, __ATOMIC_RELEASE);
+    if (priv->attr.drain_type == TASKPOOL_DRAIN_TYPE_CANCEL) {
+        __atomic_store_n(&priv->cancelling, 1, __ATOMIC_RELEASE);
+    }
+    /* Timed jobs are due now, run once more or skipped like the queued ones */
+    if (priv->wheel) {
+        wheel_flush(priv->wheel);
+    }
+    __pending_wait(priv);
+    if (priv->wheel) {
+        wheel_delete(priv->wheel);
+        priv->wheel = NULL;
+    }
+
+    /* Tell every worker to exit at once, then wait for the last one */
+    for (i = 0; i < priv->n_groups; i++) {
+        group = priv->groups[i];
+        while (__atomic_load_n(&group->n_workers, __ATOMIC_RELAXED) > 0) {
+            /* No memory for a pill, the workers free some as they exit */
+            if (__worker_retire(group)) {
+                errorf("__worker_retire err\n");
+                sched_yield();
+            }
+        }
+    }
+    __live_wait(priv);
+
+    for (i = 0; i < priv->n_groups; i++) {
+        __group_delete(priv->groups[i]);
+    }
+    if (priv->trace) {
+        trace_delete(priv->trace);
+    }
+    /* Handles never deleted go stale with the table */
+    for (i = 0; i < priv->n_chunks; i++) {
+        mem_free(priv->chunks[i]);
+    }
+    for (i = 0; i < TASKPOOL_SLOT_NUM; i++) {
+        if (priv->deques[i]) {
+            deque_delete(priv->deques[i]);
+        }
+    }
+    pthread_mutex_destroy(&priv->lock);
+    mem_free(priv);
+    mem_free(self);
+
+    return 0;
+}
+
+static int taskpool_add_group(taskpool_t *self, const taskpool_group_attr_t *attr)
+{
+    tracef("\n");
+
+    size_t i;
+    taskpool_priv_t *priv = __get_priv(self);
+    taskpool_group_t *new = NULL;
+
+    if (attr == NULL || attr->name == NULL ||
+        strlen(attr->name) >= TASKPOOL_GROUP_NAME_LEN ||
+        attr->type >= TASKPOOL_WORKER_TYPE_NONE ||
+        attr->min_workers < 0 || attr->max_workers < 0 ||
+        (attr->max_workers && attr->min_workers > attr->max_workers)) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    if (attr->max_workers && __wheel_get(priv) == NULL) {
+        errorf("__wheel_get err\n");
+        return -1;
+    }
+
+    const taskpool_job_attr_t key = {
+        .type = attr->type,
+        .sys_cpu_mask = attr->sys_cpu_mask,
+        .sys_sched_policy = attr->sys_sched_policy,
+        .sys_sched_priority = attr->sys_sched_priority,
+    };
+
+    pthread_mutex_lock(&priv->lock);
+    for (i = 0; i < priv->n_groups; i++) {
+        /* Two groups alike would make the routing of jobs ambiguous */
+        if (strcmp(priv->groups[i]->name, attr->name) == 0 ||
+            __group_match(&priv->groups[i]->attr, &key)) {
+            errorf("group %s is taken by %s\n", attr->name, priv->groups[i]->name);
+            goto err;
+        }
+    }
+    if (priv->n_groups == TASKPOOL_GROUP_NUM) {
+        errorf("too many groups\n");
+        goto err;
+    }
+
+    new = __group_create(priv, attr);
+    if (new == NULL) {
+        errorf("__group_create err\n");
+        goto err;
+    }
+    priv->groups[priv->n_groups] = new;
+    __atomic_store_n(&priv->n_groups, priv->n_groups + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&priv->lock);
+
+    if (attr->max_workers) {
+        const taskpool_worker_attr_t worker_attr = {
+            .type = new->attr.type,
+            .group = new->name,
+        };
+        for (i = 0; i < (size_t)attr->min_workers; i++) {
+            if (__worker_add(priv, new, &worker_attr)) {
+                errorf("__worker_add err\n");
+                return -1;
+            }
+        }
+        /* From now on the wheel thread grows and shrinks the group */
+        new->scaler.due = wheel_now() + TASKPOOL_SCALE_PERIOD_US;
+        if (wheel_add(priv->wheel, &new->scaler, new->scaler.due)) {
+            errorf("wheel_add err\n");
+            return -1;
+        }
+    }
+
+    return 0;
+
+err:
+    pthread_mutex_unlock(&priv->lock);
+    return -1;
+}
+
+static int __worker_add(taskpool_priv_t *priv, taskpool_group_t *group,
+                        const taskpool_worker_attr_t *attr)
+{
+    int status;
+    taskpool_worker_t *new = mem_alloc(sizeof(taskpool_worker_t));
+    if (new == NULL) {
+        errorf("mem_alloc err\n");
+        goto err;
+    }
+
+    memset(new, 0, sizeof(taskpool_worker_t));
+    memcpy(&new->attr, attr, sizeof(taskpool_worker_attr_t));
+    new->attr.type = group->attr.type;
+    new->attr.group = group->name;
+    new->job = NULL;
+    new->info = priv;
+    new->group = group;
+    INIT_LIST_HEAD(&new->ready);
+    new->keep_alive = 0;
+
+    /* Set up once here, the jobs routed to the group need no syscall */
+    task_attr_t task_attr = {};
+    task_attr.type = group->attr.type;
+    task_attr.routine = __do_task;
+    task_attr.arg = new;
+    task_attr.cpumask = group->attr.sys_cpu_mask;
+    task_attr.policy = group->attr.sys_sched_policy;
+    task_attr.priority = group->attr.sys_sched_priority;
+    /* Counted before it runs, so a del_worker right after finds it */
+    __atomic_fetch_add(&group->n_workers, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&priv->n_live, 1, __ATOMIC_RELAXED);
+    status = task_create(&task_attr, &new->task);
+    if (status) {
+        errorf("task_create err\n");
+        __atomic_fetch_sub(&priv->n_live, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&group->n_workers, 1, __ATOMIC_RELAXED);
+        goto err;
+    }
+
+    return 0;
+
+err:
+    if (new) {
+        mem_free(new);
+    }
+
+    return -1;
+}
+
+static int taskpool_add_worker(taskpool_t *self, const taskpool_worker_attr_t *attr)
+{
+    tracef("\n");
+
+    const taskpool_worker_attr_t attr_default = {
+        .type = TASKPOOL_WORKER_TYPE_THREAD,
+    };
+
+    taskpool_priv_t *priv = __get_priv(self);
+    taskpool_group_t *group = NULL;
+
+    attr = attr == NULL ? &attr_default : attr;
+    group = __group_find(priv, attr);
+    if (group == NULL) {
+        errorf("no such group\n");
+        return -1;
+    }
+
+    return __worker_add(priv, group, attr);
+}
+
+static int taskpool_del_worker(taskpool_t *self, const taskpool_worker_attr_t *attr)
+{
+    tracef("\n");
+
+    int status, n;
+    taskpool_priv_t *priv = __get_priv(self);
+    taskpool_group_t *group = NULL;
+    taskpool_job_t *pill = NULL;
+    if (attr == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    group = __group_find(priv, attr);
+    if (group == NULL) {
+        errorf("no such group\n");
+        return -1;
+    }
+
+    /* Claim one of the workers, a concurrent del_worker claims another */
+    n = __atomic_load_n(&group->n_workers, __ATOMIC_RELAXED);
+    do {
+        if (n <= 0) {
+            errorf("no worker to delete\n");
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&group->n_workers, &n, n - 1, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    /* The first worker to dequeue this record exits and marks it done */
+    pill = mem_alloc(sizeof(taskpool_job_t));
+    if (pill == NULL) {
+        errorf("mem_alloc err\n");
+        __atomic_fetch_add(&group->n_workers, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    memset(pill, 0, sizeof(taskpool_job_t));
+    pill->link.prio = TASKPOOL_JOB_PRIORITY_NUM - 1;
+    pill->exit_worker = 1;
+
+    status = que_put_to_head(group->jobs_todo, pill);
+    if (status) {
+        errorf("que_put_to_head err\n");
+        __atomic_fetch_add(&group->n_workers, 1, __ATOMIC_RELAXED);
+        mem_free(pill);
+        return -1;
+    }
+    __coro_kick(group, 1);
+    __job_wait(pill);
+    mem_free(pill);
+
+    return 0;
+}
+
+static void __job_init(taskpool_priv_t *priv, taskpool_job_t *job,
+                       const taskpool_job_attr_t *attr, int auto_free)
+{
+    const taskpool_job_attr_t __attr = {
+        .type = TASKPOOL_WORKER_TYPE_THREAD,
+        .sys_sched_policy = SCHED_OTHER,
+        .sys_sched_priority = 0,
+        .sys_cpu_mask = (size_t)(-1),
+    };
+
+    /* No memset, gen, index and next belong to the slot */
+    attr = attr == NULL ? &__attr : attr;
+    /* The attributes only pick the group, the job keeps what it runs */
+    job->link.owner = NULL;
+    job->link.prio = attr->priority;
+    job->func = attr->func;
+    job->arg = attr->arg;
+    job->group = __group_route(priv, attr);
+    job->state = TASKPOOL_JOB_STATUS_TODO;
+    job->result = 0;
+    job->succ = NULL;
+    job->timer = NULL;
+    job->n_deps = 0;
+    job->auto_free = auto_free;
+    job->exit_worker = 0;
+}
+
+/* Queue jobs of one group, return how many of them were queued */
+static int __job_submit(taskpool_group_t *group, taskpool_job_t **jobs, int n)
+{
+    int i;
+    uint64_t now;
+
+    if (group->timing) {
+        now = __now_ns();
+        for (i = 0; i < n; i++) {
+            jobs[i]->queued_ns = now;
+        }
+    }
+    for (i = 0; group->trace && i < n; i++) {
+        trace_event(group->trace, TRACE_EVENT_ENQUEUE, jobs[i], jobs[i]->func, 0);
+    }
+
+    if (s_worker && s_worker->group == group && s_worker->deque) {
+        /* Submitted from a running job, keep them on this worker */
+        for (i = 0; i < n; i++) {
+            if (deque_push(s_worker->deque, jobs[i])) {
+                break;
+            }
+        }
+        if (i) {
+            __nudge(group);
+        }
+        return i;
+    }
+
+    if (n == 1) {
+        n = que_put(group->jobs_todo, jobs[0]) ? 0 : 1;
+    } else {
+        n = que_put_batch(group->jobs_todo, (handle_t *)jobs, n);
+    }
+    if (n > 0) {
+        __coro_kick(group, n);
+    }
+
+    return n;
+}
+
+static int taskpool_add_job(taskpool_t *self, const taskpool_job_attr_t *attr, handle_t *handle)
+{
+    tracef("\n");
+
+    taskpool_priv_t *priv = __get_priv(self);
+    taskpool_job_t *new = __job_alloc(priv);
+    if (new == NULL) {
+        errorf("__job_alloc err\n");
+        goto err;
+    }
+
+    __job_init(priv, new, attr, handle ? 0 : 1);
+
+    /* Count the job first so it can never be seen done before submitted */
+    __pending_add(priv, 1);
+
+    if (__job_submit(new->group, &new, 1) != 1) {
+        errorf("__job_submit err\n");
+        __pending_sub(priv, 1);
+        __job_free(priv, new);
+        return -1;
+    }
+
+    if (handle) {
+        *handle = __job_handle(new);
+        tracef("%p\n", *handle);
+    }
+
+    return 0;
+
+err:
+    return -1;
+}
+
+static int taskpool_add_jobs(taskpool_t *self, const taskpool_job_attr_t *attrs, size_t n, handle_t *handles)
+{
+    tracef("%zu\n", n);
+
+    int i, run, got, status, queued = 0;
+    taskpool_priv_t *priv = __get_priv(self);
+    taskpool_job_t **news = NULL;
+
+    if (attrs == NULL || n > INT_MAX) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    news = mem_alloc(n * sizeof(taskpool_job_t *));
+    if (news == NULL) {
+        errorf("mem_alloc err\n");
+        return -1;
+    }
+
+    /* A whole run of free slots per CAS, the table grows in between */
+    for (i = 0; i < n; i += got) {
+        got = __job_alloc_batch(priv, news + i, n - i);
+        if (got < 0) {
+            errorf("__job_alloc_batch err\n");
+            while (i > 0) {
+                __job_free(priv, news[--i]);
+            }
+            mem_free(news);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        __job_init(priv, news[i], &attrs[i], handles ? 0 : 1);
+    }
+
+    __pending_add(priv, n);
+
+    /* One submission per run of jobs headed to the same group */
+    for (i = 0; i < n; i += run) {
+        for (run = 1; i + run < n && news[i + run]->group == news[i]->group; run++) {
+        }
+        status = __job_submit(news[i]->group, news + i, run);
+        queued += status > 0 ? status : 0;
+        if (status != run) {
+            break;
+        }
+    }
+    if (queued < n) {
+        errorf("__job_submit err, %d of %zu jobs queued\n", queued, n);
+        __pending_sub(priv, n - queued);
+        for (i = queued; i < n; i++) {
+            __job_free(priv, news[i]);
+            news[i] = NULL;
+        }
+    }
+
+    for (i = 0; handles && i < n; i++) {
+        handles[i] = news[i] ? __job_handle(news[i]) : NULL;
+    }
+    mem_free(news);
+
+    return queued == n ? 0 : -1;
+}
+
+static int taskpool_add_job_after(taskpool_t *self, const taskpool_job_attr_t *attr,
+                                  const handle_t *deps, size_t n_deps, handle_t *handle)
+{
+    tracef("%zu\n", n_deps);
+
+    size_t i;
+    taskpool_priv_t *priv = __get_priv(self);
+    taskpool_edge_t *edges = NULL;
+    taskpool_edge_t *edge = NULL;
+    taskpool_job_t *new = NULL;
+    taskpool_job_t *dep = NULL;
+
+    if (deps == NULL && n_deps) {
+        errorf("paramter err\n");
+        return -1;
+    }
+    for (i = 0; i < n_deps; i++) {
+        if (__get_job(priv, deps[i]) == NULL) {
+            errorf("invalid job handle\n");
+            return -1;
+        }
+    }
+
+    /* Allocate every edge up front, an attached one cannot be taken back */
+    for (i = 0; i < n_deps; i++) {
+        edge = mem_alloc(sizeof(taskpool_edge_t));
+        if (edge == NULL) {
+            errorf("mem_alloc err\n");
+            goto err;
+        }
+        edge->next = edges;
+        edges = edge;
+    }
+
+    new = __job_alloc(priv);
+    if (new == NULL) {
+        errorf("__job_alloc err\n");
+        goto err;
+    }
+
+    __job_init(priv, new, attr, handle ? 0 : 1);
+    __pending_add(priv, 1);
+
+    /* Hold a count of our own so it cannot start before all edges are in */
+    new->n_deps = 1;
+    for (i = 0; i < n_deps; i++) {
+        edge = edges;
+        edges = edge->next;
+        edge->job = new;
+        __atomic_fetch_add(&new->n_deps, 1, __ATOMIC_RELAXED);
+        /* Deleted meanwhile counts as done */
+        dep = __get_job(priv, deps[i]);
+        if (dep == NULL || !__edge_attach(dep, edge)) {
+            __atomic_fetch_sub(&new->n_deps, 1, __ATOMIC_RELAXED);
+            mem_free(edge);
+        }
+    }
+
+    if (handle) {
+        *handle = __job_handle(new);
+    }
+
+    if (__atomic_sub_fetch(&new->n_deps, 1, __ATOMIC_ACQ_REL) == 0 &&
+        __job_submit(new->group, &new, 1) != 1) {
+        errorf("__job_submit err\n");
+        __pending_sub(priv, 1);
+        __job_free(priv, new);
+        if (handle) {
+            *handle = NULL;
+        }
+        return -1;
+    }
+
+    return 0;
 
-    assert(handle);
-    priv = ((taskpool_t *)handle)->priv;
-    assert(priv);
-    assert(priv->magic == TASKPOOL_MAGIC);
+err:
+    while (edges) {
+        edge = edges;
+        edges = edge->next;
+        mem_free(edge);
+    }
 
-    return priv;
+    return -1;
 }
 
-static inline taskpool_job_t *__get_job(handle_t handle)
+static int taskpool_then(taskpool_t *self, handle_t job, const taskpool_job_attr_t *attr, handle_t *handle)
 {
-    taskpool_job_t *job = handle;
-
-    assert(job);
-    assert(job->magic == TASKPOOL_MAGIC);
+    tracef("%p\n", job);
 
-    return job;
+    return taskpool_add_job_after(self, attr, &job, 1, handle);
 }
 
-static void *__do_task(void *arg)
+static int taskpool_add_timed_job(taskpool_t *self, const taskpool_job_attr_t *attr,
+                                  size_t delay_ms, size_t period_ms, handle_t *handle)
 {
-    int status;
-    taskpool_worker_t *worker = arg;
-
-    status = que_put(worker->info->workers[worker->attr.type], worker);
-    assert(!status);
-    tracef("worker %p start\n", worker);
+    tracef("%zu %zu\n", delay_ms, period_ms);
 
-    worker->keep_alive = 1;
-    while (worker->keep_alive) {
-        status = que_get(worker->info->jobs_todo, (handle_t *)&worker->job, 1);
-        if (status || worker->job == (handle_t)TASKPOOL_MAGIC) {
-            worker->keep_alive = 0;
-            status = que_remove(worker->info->workers[worker->attr.type], worker);
-            assert(!status);
-            goto end;
-        }
+    taskpool_priv_t *priv = __get_priv(self);
+    taskpool_job_t *new = NULL;
+    taskpool_timer_t *timer = NULL;
 
-        pthread_mutex_lock(&worker->job->lock);
-        worker->job->status.status = TASKPOOL_JOB_STATUS_DOING;
-        pthread_mutex_unlock(&worker->job->lock);
+    if (__wheel_get(priv) == NULL) {
+        errorf("__wheel_get err\n");
+        return -1;
+    }
 
-        status |= task_set_affinity(worker->task, worker->job->attr.sys_cpu_mask);
-        status |= task_set_schedpolicy(worker->task, worker->job->attr.sys_sched_policy);
-        status |= task_set_schedpriority(worker->task, worker->job->attr.sys_sched_priority);
-        assert(!status);
+    new = __job_alloc(priv);
+    if (new == NULL) {
+        errorf("__job_alloc err\n");
+        return -1;
+    }
+    timer = mem_alloc(sizeof(taskpool_timer_t));
+    if (timer == NULL) {
+        errorf("mem_alloc err\n");
+        __job_free(priv, new);
+        return -1;
+    }
 
-        tracef("worker %p is doing job %p ...\n", worker, worker->job);
-        status = worker->job->attr.func(worker->job->attr.arg);
-        tracef("worker %p finish job %p\n", worker, worker->job);
+    __job_init(priv, new, attr, handle ? 0 : 1);
+    memset(timer, 0, sizeof(taskpool_timer_t));
+    timer->job = new;
+    timer->group = new->group;
+    timer->period = (uint64_t)period_ms * 1000;
+    timer->due = wheel_now() + (uint64_t)delay_ms * 1000;
+    new->timer = timer;
+    __pending_add(priv, 1);
 
-        pthread_mutex_lock(&worker->job->lock);
-        worker->job->status.errno = status;
-        worker->job->status.status = TASKPOOL_JOB_STATUS_DONE;
-        pthread_mutex_unlock(&worker->job->lock);
+    if (handle) {
+        *handle = __job_handle(new);
+    }
 
-        if (worker->job->auto_free) {
-            pthread_mutex_destroy(&worker->job->lock);
-            mem_free(worker->job);
-        } else {
-            que_put(worker->info->jobs_keep, worker->job);
+    if (wheel_add(priv->wheel, timer, timer->due)) {
+        errorf("wheel_add err\n");
+        __pending_sub(priv, 1);
+        __job_free(priv, new);
+        if (handle) {
+            *handle = NULL;
         }
-        worker->job = NULL;
-        pthread_mutex_lock(&worker->info->lock);
-        worker->info->n_done_jobs++;
-        pthread_mutex_unlock(&worker->info->lock);
-    end:
-        pthread_cond_broadcast(&worker->info->event);
+        return -1;
     }
 
-    tracef("worker %p end\n", worker);
-    task_delete(worker->task);
-    mem_free(worker);
-    return NULL;
+    return 0;
 }
 
-static int taskpool_deinit(taskpool_t *self)
+static int taskpool_del_job(struct taskpool *self, handle_t handle)
 {
-    tracef("\n");
+    tracef("%p\n", handle);
 
-    int status, type;
+    unsigned int gen = (uintptr_t)handle >> TASKPOOL_HANDLE_INDEX_BITS;
     taskpool_priv_t *priv = __get_priv(self);
-    taskpool_job_t *job = NULL;
-
-    pthread_mutex_lock(&priv->lock);
-    while (que_len(priv->jobs_todo)) {
-        pthread_cond_wait(&priv->event, &priv->lock);
+    taskpool_job_t *job = __get_job(priv, handle);
+    handle_t wheel = __atomic_load_n(&priv->wheel, __ATOMIC_ACQUIRE);
+
+    /*
+     * The handle goes stale here, not when the slot is freed. A job marked
+     * cancelled in a ring or a deque is freed later by the worker taking
+     * it, a second del_job must not free it meanwhile.
+     */
+    if (job == NULL || !__atomic_compare_exchange_n(&job->gen, &gen, gen + 1, 0,
+                                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        errorf("invalid job handle\n");
+        return -1;
     }
-    pthread_mutex_unlock(&priv->lock);
 
-    for (type = TASKPOOL_WORKER_TYPE_THREAD;
-         type < TASKPOOL_WORKER_TYPE_NONE; type++) {
-        while (que_len(priv->workers[type])) {
-            const taskpool_worker_attr_t attr = {.type = type};
-            status = self->del_worker(self, &attr);
-            assert(!status);
-        }
-        /* Wait for all wroker exiting */
-        sleep(1);
+    /* A periodic job being run now is not put back on the wheel */
+    if (job->timer) {
+        __atomic_store_n(&job->timer->period, 0, __ATOMIC_SEQ_CST);
     }
 
-    while (que_len(priv->jobs_keep)) {
-        status = que_peek(priv->jobs_keep, (handle_t *)&job);
-        assert(!status);
-        status = self->del_job(self, job);
-        assert(!status);
+    /* Unlinked in O(1) from the wheel or a list, no worker can reach it */
+    if ((job->timer && wheel_cancel(wheel, job->timer) == 0) ||
+        (priv->attr.queue_type != TASKPOOL_QUEUE_TYPE_RING &&
+         que_remove(job->group->jobs_todo, job) == 0)) {
+        /* It will never run, stop counting it and let its successors go */
+        __atomic_fetch_add(&priv->n_cancelled, 1, __ATOMIC_RELAXED);
+        __succ_release(NULL, __succ_take(job));
+        __pending_sub(priv, 1);
+        __job_free(priv, job);
+        return 0;
     }
 
-    for (type = TASKPOOL_WORKER_TYPE_THREAD;
-         type < TASKPOOL_WORKER_TYPE_NONE; type++) {
-        que_delete(priv->workers[type]);
+    /* In a ring, a deque or waiting for its predecessors, mark it instead */
+    if (__job_cancel(job) == 0) {
+        return 0;
     }
-    que_delete(priv->jobs_todo);
-    que_delete(priv->jobs_keep);
-    pthread_cond_destroy(&priv->event);
-    pthread_mutex_destroy(&priv->lock);
-    mem_free(priv);
-    mem_free(self);
+
+    /* Taken by a worker already */
+    __job_wait(job);
+    __job_free(priv, job);
 
     return 0;
 }
 
-static int taskpool_add_worker(taskpool_t *self, const taskpool_worker_attr_t *attr)
+static int taskpool_get_job_status(taskpool_t *self, handle_t handle, taskpool_job_status_t *status)
 {
-    tracef("\n");
-
-    const taskpool_worker_attr_t attr_default = {
-        .type = TASKPOOL_WORKER_TYPE_THREAD,
-    };
+    tracef("%p\n", handle);
 
-    int status;
-    taskpool_priv_t *priv = __get_priv(self);
-    taskpool_worker_t *new = mem_alloc(sizeof(taskpool_worker_t));
-    if (new == NULL) {
-        errorf("mem_alloc err\n");
-        goto err;
+    taskpool_job_t *job = __get_job(__get_priv(self), handle);
+    if (status == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+    if (job == NULL) {
+        errorf("invalid job handle\n");
+        return -1;
     }
 
-    memset(new, 0, sizeof(taskpool_worker_t));
-    attr = attr == NULL ? &attr_default : attr;
-    memcpy(&new->attr, attr, sizeof(taskpool_worker_attr_t));
-    new->job = NULL;
-    new->info = priv;
-    new->keep_alive = 0;
+    /* The result is stored before the status it comes with */
+    status->status = __atomic_load_n(&job->state, __ATOMIC_ACQUIRE) & TASKPOOL_STATE_MASK;
+    status->errno = __atomic_load_n(&job->result, __ATOMIC_RELAXED);
 
-    task_attr_t task_attr = {};
-    task_attr.type = attr->type;
-    task_attr.routine = __do_task;
-    task_attr.arg = new;
-    status = task_create(&task_attr, &new->task);
-    if (status) {
-        errorf("task_create err\n");
-        goto err;
+    return 0;
+}
+
+static int taskpool_wait_job_done(taskpool_t *self, handle_t handle)
+{
+    tracef("%p\n", handle);
+
+    taskpool_job_t *job = __get_job(__get_priv(self), handle);
+    if (job == NULL) {
+        errorf("invalid job handle\n");
+        return -1;
     }
 
+    __job_wait(job);
+
+    tracef("%p done\n", handle);
     return 0;
+}
 
-err:
-    if (new) {
-        mem_free(new);
-    }
+static int taskpool_wait_all_jobs_done(struct taskpool *self)
+{
+    tracef("\n");
 
-    return -1;
+    taskpool_priv_t *priv = __get_priv(self);
+
+    __pending_wait(priv);
+
+    return 0;
 }
 
-static int taskpool_del_worker(taskpool_t *self, const taskpool_worker_attr_t *attr)
+static int taskpool_get_stats(taskpool_t *self, taskpool_stats_t *stats)
 {
     tracef("\n");
 
-    int status;
+    int len;
+    size_t i;
+    list_t *pos = NULL;
     taskpool_priv_t *priv = __get_priv(self);
-    if (attr == NULL) {
+    taskpool_worker_t *worker = NULL;
+    taskpool_worker_stats_t *workers = NULL;
+    taskpool_shard_t sum;
+
+    if (stats == NULL || (stats->workers == NULL && stats->max_workers)) {
         errorf("paramter err\n");
         return -1;
     }
 
-    if (que_len(priv->workers[attr->type]) == 0) {
-        errorf("no worker to delete\n");
-        return -1;
-    }
+    workers = stats->workers;
+    i = stats->max_workers;
+    memset(stats, 0, sizeof(taskpool_stats_t));
+    stats->workers = workers;
+    stats->max_workers = i;
 
     pthread_mutex_lock(&priv->lock);
-    status = que_put_to_head(priv->jobs_todo, (handle_t)TASKPOOL_MAGIC);
-    assert(!status);
-    pthread_cond_wait(&priv->event, &priv->lock);
+    memcpy(&sum, &priv->retired, sizeof(taskpool_shard_t));
+    list_for_each(pos, &priv->workers) {
+        worker = list_entry(pos, taskpool_worker_t, node);
+        if (stats->n_workers < stats->max_workers) {
+            workers[stats->n_workers].group = worker->group->name;
+            workers[stats->n_workers].runs = __atomic_load_n(&worker->stats.runs, __ATOMIC_RELAXED);
+            workers[stats->n_workers].failed = __atomic_load_n(&worker->stats.failed, __ATOMIC_RELAXED);
+            workers[stats->n_workers].busy_ns = __atomic_load_n(&worker->stats.busy_ns, __ATOMIC_RELAXED);
+        }
+        __stat_fold(&sum, &worker->stats);
+        stats->n_workers++;
+    }
+    for (i = 0; i < priv->n_groups; i++) {
+        len = que_len(priv->groups[i]->jobs_todo);
+        stats->queue_depth += len > 0 ? len : 0;
+    }
+    for (i = 0; i < TASKPOOL_SLOT_NUM; i++) {
+        len = priv->deques[i] ? deque_len(priv->deques[i]) : 0;
+        stats->queue_depth += len > 0 ? len : 0;
+    }
     pthread_mutex_unlock(&priv->lock);
 
+    /* Every job added is pending, done or cancelled, at least for a moment */
+    len = __atomic_load_n(&priv->n_pending, __ATOMIC_RELAXED);
+    stats->pending = len > 0 ? len : 0;
+    stats->completed = sum.completed;
+    stats->failed = sum.failed;
+    stats->cancelled = sum.cancelled + __atomic_load_n(&priv->n_cancelled, __ATOMIC_RELAXED);
+    stats->submitted = stats->pending + stats->completed + stats->cancelled;
+    memcpy(stats->wait_ns, sum.wait_ns, sizeof(stats->wait_ns));
+    memcpy(stats->run_ns, sum.run_ns, sizeof(stats->run_ns));
+
     return 0;
 }
 
-static int taskpool_add_job(taskpool_t *self, const taskpool_job_attr_t *attr, handle_t *handle)
+static int taskpool_dump_trace(taskpool_t *self, const char *path)
 {
     tracef("\n");
 
-    const taskpool_job_attr_t __attr = {
-        .type = TASKPOOL_WORKER_TYPE_THREAD,
-        .sys_sched_policy = SCHED_RR,
-        .sys_sched_priority = 0,
-        .sys_cpu_mask = (size_t)(-1),
-    };
-
-    int status;
     taskpool_priv_t *priv = __get_priv(self);
-    taskpool_job_t *new = mem_alloc(sizeof(taskpool_job_t));
-    if (new == NULL) {
-        errorf("mem_alloc err\n");
-        goto err;
+
+    if (path == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+    if (priv->trace == NULL) {
+        errorf("tracing is off, set trace_events\n");
+        return -1;
     }
 
-    memset(new, 0, sizeof(taskpool_job_t));
-    new->magic = TASKPOOL_MAGIC;
-    status = pthread_mutex_init(&new->lock, NULL);
-    assert(!status);
-    attr = attr == NULL ? &__attr : attr;
-    memcpy(&new->attr, attr, sizeof(taskpool_job_attr_t));
-    new->status.status = TASKPOOL_JOB_STATUS_TODO;
-    new->auto_free = handle ? 0 : 1;
+    return trace_dump(priv->trace, path);
+}
 
-    status = que_put(priv->jobs_todo, new);
-    if (status) {
-        errorf("que_put err\n");
-        goto err;
+static taskpool_range_t *__range_new(taskpool_loop_t *loop, size_t begin, size_t end)
+{
+    taskpool_range_t *range = mem_alloc(sizeof(taskpool_range_t) + loop->size);
+    if (range == NULL) {
+        return NULL;
     }
 
-    pthread_mutex_lock(&priv->lock);
-    priv->n_total_jobs++;
-    pthread_mutex_unlock(&priv->lock);
+    range->loop = loop;
+    range->next = NULL;
+    range->begin = begin;
+    range->end = end;
+    range->taken = 0;
+    range->done = TASKPOOL_RANGE_DOING;
+    range->refs = 1;
+    if (loop->size) {
+        memcpy(range->value, loop->identity, loop->size);
+    }
 
-    if (handle) {
-        *handle = new;
-        tracef("%p\n", *handle);
+    return range;
+}
+
+static void __range_put(taskpool_range_t *range)
+{
+    if (__atomic_sub_fetch(&range->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        mem_free(range);
     }
+}
 
-    return 0;
+static inline int __range_claim(taskpool_range_t *range)
+{
+    return !__atomic_exchange_n(&range->taken, 1, __ATOMIC_ACQUIRE);
+}
 
-err:
-    if (new) {
-        mem_free(new);
+static void __range_wait(taskpool_range_t *range)
+{
+    int val;
+
+    while ((val = __atomic_load_n(&range->done, __ATOMIC_ACQUIRE)) != TASKPOOL_RANGE_DONE) {
+        if (task_in_coroutine()) {
+            task_yield(1);
+            continue;
+        }
+        if (val == TASKPOOL_RANGE_DOING &&
+            !__atomic_compare_exchange_n(&range->done, &val, TASKPOOL_RANGE_WAITED, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        futex_wait(&range->done, TASKPOOL_RANGE_WAITED);
     }
+}
 
-    return -1;
+static void __range_run(taskpool_range_t *range);
+
+static int __range_job(void *arg)
+{
+    taskpool_range_t *range = arg;
+
+    /* Its runner may have got to it first */
+    if (__range_claim(range)) {
+        __range_run(range);
+    }
+    __range_put(range);
+
+    return 0;
 }
 
-static int taskpool_del_job(struct taskpool *self, handle_t handle)
+/* Offer a piece to the workers, it stays with its runner if none can take it */
+static void __range_spawn(taskpool_range_t *range)
 {
-    tracef("%p\n", handle);
+    taskpool_loop_t *loop = range->loop;
+    taskpool_priv_t *priv = loop->priv;
+    taskpool_job_t *job = NULL;
 
-    taskpool_priv_t *priv = __get_priv(self);
-    taskpool_job_t *job = __get_job(handle);
+    if (loop->group == NULL) {
+        return;
+    }
+    job = __job_alloc(priv);
+    if (job == NULL) {
+        return;
+    }
+
+    __job_init(priv, job, NULL, 1);
+    job->func = __range_job;
+    job->arg = range;
+    job->group = loop->group;
+    __atomic_fetch_add(&range->refs, 1, __ATOMIC_RELAXED);
+    __pending_add(priv, 1);
+
+    if (__job_submit(loop->group, &job, 1) != 1) {
+        __pending_sub(priv, 1);
+        __job_free(priv, job);
+        __atomic_fetch_sub(&range->refs, 1, __ATOMIC_RELAXED);
+    }
+}
 
-    pthread_mutex_lock(&job->lock);
-    que_remove(priv->jobs_todo, job);
-    if (job->status.status == TASKPOOL_JOB_STATUS_DOING) {
-        while (job->status.status != TASKPOOL_JOB_STATUS_DONE) {
-            pthread_cond_wait(&priv->event, &job->lock);
+/*
+ * Split the upper half off until a grain is left and run that, then the
+ * halves from the smallest one up, here if nobody claimed them meanwhile,
+ * so the values are joined left to right and no wait is on a queued piece.
+ */
+static void __range_run(taskpool_range_t *range)
+{
+    taskpool_loop_t *loop = range->loop;
+    taskpool_range_t *halves = NULL;
+    taskpool_range_t *half = NULL;
+    size_t end = range->end;
+
+    while (end - range->begin > loop->grain) {
+        half = __range_new(loop, range->begin + (end - range->begin) / 2, end);
+        if (half == NULL) {
+            break;
         }
+        half->next = halves;
+        halves = half;
+        __range_spawn(half);
+        end = half->begin;
+    }
+
+    if (loop->size) {
+        loop->fold(range->begin, end, range->value, loop->ctx);
+    } else {
+        loop->func(range->begin, end, loop->ctx);
     }
-    que_remove(priv->jobs_keep, job);
-    pthread_mutex_unlock(&job->lock);
 
-    pthread_mutex_destroy(&job->lock);
-    mem_free(job);
+    while (halves) {
+        half = halves;
+        halves = half->next;
+        if (__range_claim(half)) {
+            __range_run(half);
+        } else {
+            __range_wait(half);
+        }
+        if (loop->size) {
+            loop->join(range->value, half->value, loop->ctx);
+        }
+        __range_put(half);
+    }
 
-    return 0;
+    if (__atomic_exchange_n(&range->done, TASKPOOL_RANGE_DONE, __ATOMIC_RELEASE) ==
+        TASKPOOL_RANGE_WAITED) {
+        futex_wake(&range->done, INT_MAX);
+    }
 }
 
-static int taskpool_get_job_status(taskpool_t *self, handle_t handle, taskpool_job_status_t *status)
+/* Return the root piece once all are done, the caller reads and puts it */
+static taskpool_range_t *__loop_run(taskpool_priv_t *priv, taskpool_loop_t *loop,
+                                    size_t begin, size_t end)
 {
-    tracef("%p\n", handle);
+    taskpool_range_t *root = NULL;
+    int n_threads;
+
+    /* From a job, the pieces go to the deque of its worker */
+    loop->priv = priv;
+    loop->group = s_worker && s_worker->info == priv ? s_worker->group :
+                  priv->groups[TASKPOOL_WORKER_TYPE_THREAD];
+    n_threads = __atomic_load_n(&loop->group->n_workers, __ATOMIC_RELAXED) + 1;
+    if (n_threads == 1) {
+        /* Nobody to share with, the caller runs it in one go */
+        loop->group = NULL;
+        loop->grain = end - begin;
+    } else if (loop->grain == 0) {
+        loop->grain = (end - begin) / (n_threads * TASKPOOL_RANGE_SPLIT);
+        loop->grain = loop->grain ? loop->grain : 1;
+    }
 
-    taskpool_job_t *job = __get_job(handle);
-    if (status == NULL) {
-        errorf("paramter err\n");
-        return -1;
+    root = __range_new(loop, begin, end);
+    if (root == NULL) {
+        errorf("mem_alloc err\n");
+        return NULL;
     }
 
-    pthread_mutex_lock(&job->lock);
-    *status = job->status;
-    pthread_mutex_unlock(&job->lock);
+    /* The caller runs the root, and the pieces nobody else took */
+    root->taken = 1;
+    __range_run(root);
 
-    return 0;
+    return root;
 }
 
-static int taskpool_wait_job_done(taskpool_t *self, handle_t handle)
+static int taskpool_parallel_for(taskpool_t *self, size_t begin, size_t end, size_t grain,
+                                 void (*func)(size_t begin, size_t end, void *ctx), void *ctx)
 {
-    tracef("%p\n", handle);
+    tracef("%zu %zu %zu\n", begin, end, grain);
 
-    taskpool_priv_t *priv = __get_priv(self);
-    taskpool_job_t *job = __get_job(handle);
+    taskpool_loop_t loop = {
+        .grain = grain,
+        .func = func,
+        .ctx = ctx,
+    };
+
+    taskpool_range_t *root = NULL;
 
-    pthread_mutex_lock(&job->lock);
-    while (job->status.status != TASKPOOL_JOB_STATUS_DONE) {
-        pthread_cond_wait(&priv->event, &job->lock);
+    if (begin > end || func == NULL) {
+        errorf("paramter err\n");
+        return -1;
     }
-    pthread_mutex_unlock(&job->lock);
 
-    tracef("%p done\n", handle);
+    if (begin == end) {
+        return 0;
+    }
+
+    root = __loop_run(__get_priv(self), &loop, begin, end);
+    if (root == NULL) {
+        errorf("__loop_run err\n");
+        return -1;
+    }
+    __range_put(root);
+
     return 0;
 }
 
-static int taskpool_wait_all_jobs_done(struct taskpool *self)
+static int taskpool_parallel_reduce(taskpool_t *self, size_t begin, size_t end, size_t grain,
+                                    void *result, size_t size,
+                                    void (*func)(size_t begin, size_t end, void *value, void *ctx),
+                                    void (*join)(void *value, const void *other, void *ctx),
+                                    void *ctx)
 {
-    tracef("\n");
+    tracef("%zu %zu %zu\n", begin, end, grain);
+
+    taskpool_loop_t loop = {
+        .grain = grain,
+        .size = size,
+        .identity = result,
+        .fold = func,
+        .join = join,
+        .ctx = ctx,
+    };
 
-    taskpool_priv_t *priv = __get_priv(self);
+    taskpool_range_t *root = NULL;
 
-    pthread_mutex_lock(&priv->lock);
-    while (!(que_len(priv->jobs_todo) == 0 &&
-             priv->n_done_jobs == priv->n_total_jobs)) {
-        pthread_cond_wait(&priv->event, &priv->lock);
+    if (begin > end || result == NULL || size == 0 || func == NULL || join == NULL) {
+        errorf("paramter err\n");
+        return -1;
     }
-    pthread_mutex_unlock(&priv->lock);
+
+    if (begin == end) {
+        return 0;
+    }
+
+    root = __loop_run(__get_priv(self), &loop, begin, end);
+    if (root == NULL) {
+        errorf("__loop_run err\n");
+        return -1;
+    }
+    memcpy(result, root->value, size);
+    __range_put(root);
 
     return 0;
 }
 
 taskpool_t *taskpool_init()
+{
+    return taskpool_init_ex(NULL);
+}
+
+taskpool_t *taskpool_init_ex(const taskpool_attr_t *attr)
 {
     tracef("\n");
 
+    const taskpool_attr_t attr_default = {
+        .queue_type = TASKPOOL_QUEUE_TYPE_LIST,
+    };
     int status, type;
+    size_t i;
+    taskpool_t *obj = NULL;
     taskpool_priv_t *priv = (taskpool_priv_t *)mem_alloc(sizeof(taskpool_priv_t));
     if (priv == NULL) {
         errorf("mem_alloc err\n");
@@ -374,28 +2393,40 @@ taskpool_t *taskpool_init()
 
     memset(priv, 0, sizeof(taskpool_priv_t));
     priv->magic = TASKPOOL_MAGIC;
+    attr = attr == NULL ? &attr_default : attr;
+    memcpy(&priv->attr, attr, sizeof(taskpool_attr_t));
+    if (priv->attr.idle_spinners <= 0) {
+        /* None on a single cpu, a spinner would only delay the producer */
+        priv->attr.idle_spinners = get_nprocs() / 2;
+    }
     status = pthread_mutex_init(&priv->lock, NULL);
     if (status) {
         errorf("pthread_mutex_init err\n");
         goto err;
     }
-    status = pthread_cond_init(&priv->event, NULL);
-    if (status) {
-        errorf("pthread_cond_init err\n");
+    INIT_LIST_HEAD(&priv->workers);
+    if (priv->attr.mem_high_water && mem_set_high_water(priv->attr.mem_high_water)) {
+        errorf("mem_set_high_water err\n");
+        goto err;
+    }
+    if (priv->attr.trace_events && trace_create(priv->attr.trace_events, &priv->trace)) {
+        errorf("trace_create err\n");
         goto err;
     }
     for (type = TASKPOOL_WORKER_TYPE_THREAD;
          type < TASKPOOL_WORKER_TYPE_NONE; type++) {
-        status |= que_create(&priv->workers[type]);
-    }
-    status |= que_create(&priv->jobs_todo);
-    status |= que_create(&priv->jobs_keep);
-    if (status) {
-        errorf("que_create err\n");
-        goto err;
+        const taskpool_group_attr_t group_attr = {
+            .name = s_group_name[type],
+            .type = type,
+        };
+        priv->groups[type] = __group_create(priv, &group_attr);
+        if (priv->groups[type] == NULL) {
+            errorf("__group_create err\n");
+            goto err;
+        }
+        priv->n_groups++;
     }
-
-    taskpool_t *obj = (taskpool_t *)mem_alloc(sizeof(taskpool_t));
+    obj = (taskpool_t *)mem_alloc(sizeof(taskpool_t));
     if (obj == NULL) {
         errorf("mem_alloc err\n");
         goto err;
@@ -404,13 +2435,22 @@ taskpool_t *taskpool_init()
     memset(obj, 0, sizeof(taskpool_t));
     obj->priv = priv;
     obj->deinit = taskpool_deinit;
+    obj->add_group = taskpool_add_group;
     obj->add_worker = taskpool_add_worker;
     obj->del_worker = taskpool_del_worker;
     obj->add_job = taskpool_add_job;
+    obj->add_jobs = taskpool_add_jobs;
+    obj->add_job_after = taskpool_add_job_after;
+    obj->then = taskpool_then;
+    obj->add_timed_job = taskpool_add_timed_job;
     obj->del_job = taskpool_del_job;
     obj->get_job_status = taskpool_get_job_status;
     obj->wait_job_done = taskpool_wait_job_done;
     obj->wait_all_jobs_done = taskpool_wait_all_jobs_done;
+    obj->get_stats = taskpool_get_stats;
+    obj->dump_trace = taskpool_dump_trace;
+    obj->parallel_for = taskpool_parallel_for;
+    obj->parallel_reduce = taskpool_parallel_reduce;
 
     return obj;
 
@@ -420,16 +2460,25 @@ err:
     }
 
     if (priv) {
-        for (type = TASKPOOL_WORKER_TYPE_THREAD;
-             type < TASKPOOL_WORKER_TYPE_NONE; type++) {
-            que_delete(priv->workers[type]);
+        for (i = 0; i < priv->n_groups; i++) {
+            __group_delete(priv->groups[i]);
+        }
+        if (priv->trace) {
+            trace_delete(priv->trace);
         }
-        que_delete(priv->jobs_todo);
-        que_delete(priv->jobs_keep);
-        pthread_cond_destroy(&priv->event);
         pthread_mutex_destroy(&priv->lock);
         mem_free(priv);
     }
 
     return NULL;
-}
\ No newline at end of file
+}
+
+int taskpool_yield(void)
+{
+    return task_yield(0);
+}
+
+int taskpool_log_async(int async)
+{
+    return log_setasync(async);
+}
@@ -0,0 +1,280 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "list.h"
+#include "log.h"
+#include "mem.h"
+
+#define TRACE_NAME_LEN (32)
+
+typedef struct {
+    uint64_t ns;
+    const void *job;
+    const void *func;
+    int type;
+    int arg;
+} trace_rec_t;
+
+typedef struct {
+    list_t list;
+    pid_t tid;
+    char name[TRACE_NAME_LEN];
+    size_t head;                /* events written so far, by its thread alone */
+    trace_rec_t recs[0];
+} trace_ring_t;
+
+typedef struct {
+    uint64_t id;
+    size_t size;                /* events of a ring, a power of 2 */
+    uint64_t base;              /* monotonic ns the timestamps start from */
+    pthread_mutex_t lock;
+    list_t rings;
+} trace_priv_t;
+
+static const struct {
+    const char *name;
+    const char *phase;
+} s_trace_event[TRACE_EVENT_NONE] = {
+    [TRACE_EVENT_ENQUEUE] = { "enqueue", "i" },
+    [TRACE_EVENT_START] = { "job", "B" },
+    [TRACE_EVENT_END] = { "job", "E" },
+    [TRACE_EVENT_STEAL] = { "steal", "i" },
+    [TRACE_EVENT_PARK] = { "parked", "B" },
+    [TRACE_EVENT_UNPARK] = { "parked", "E" },
+    [TRACE_EVENT_CORO_START] = { "job", "b" },
+    [TRACE_EVENT_CORO_END] = { "job", "e" },
+    [TRACE_EVENT_CORO_PARK] = { "parked", "b" },
+    [TRACE_EVENT_CORO_UNPARK] = { "parked", "e" },
+};
+
+/* Tells a recorder from an older one freed at the same address */
+static uint64_t s_trace_id;
+/* The ring of the current thread in the recorder it was last used with */
+static __thread uint64_t s_ring_id;
+static __thread trace_ring_t *s_ring;
+
+static inline uint64_t __now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The ring of the current thread, made on its first event */
+static trace_ring_t *__ring_get(trace_priv_t *pPriv)
+{
+    pid_t tid;
+    list_t *p = NULL;
+    trace_ring_t *ring = NULL;
+
+    if (s_ring_id == pPriv->id) {
+        return s_ring;
+    }
+
+    tid = syscall(SYS_gettid);
+    pthread_mutex_lock(&pPriv->lock);
+    list_for_each(p, &pPriv->rings) {
+        if (list_entry(p, trace_ring_t, list)->tid == tid) {
+            ring = list_entry(p, trace_ring_t, list);
+            break;
+        }
+    }
+    if (ring == NULL) {
+        ring = mem_alloc(sizeof(trace_ring_t) + pPriv->size * sizeof(trace_rec_t));
+        if (ring) {
+            ring->tid = tid;
+            snprintf(ring->name, sizeof(ring->name), "thread %d", tid);
+            ring->head = 0;
+            list_add_tail(&ring->list, &pPriv->rings);
+        }
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+
+    if (ring) {
+        s_ring_id = pPriv->id;
+        s_ring = ring;
+    }
+
+    return ring;
+}
+
+int trace_create(size_t events, void **handle)
+{
+    trace_priv_t *pPriv = NULL;
+
+    if (events == 0 || handle == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    pPriv = (trace_priv_t *)mem_alloc(sizeof(trace_priv_t));
+    if (pPriv == NULL) {
+        errorf("mem_alloc err\n");
+        return -1;
+    }
+
+    memset(pPriv, 0, sizeof(trace_priv_t));
+    pPriv->id = __atomic_add_fetch(&s_trace_id, 1, __ATOMIC_RELAXED);
+    for (pPriv->size = 1; pPriv->size < events; pPriv->size <<= 1) {
+    }
+    pPriv->base = __now_ns();
+    pthread_mutex_init(&pPriv->lock, NULL);
+    INIT_LIST_HEAD(&pPriv->rings);
+
+    *handle = pPriv;
+    return 0;
+}
+
+int trace_delete(void *handle)
+{
+    trace_priv_t *pPriv = (trace_priv_t *)handle;
+    list_t *p, *tmp;
+
+    if (pPriv == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    list_for_each_safe(p, tmp, &pPriv->rings) {
+        list_del(p);
+        mem_free(list_entry(p, trace_ring_t, list));
+    }
+    pthread_mutex_destroy(&pPriv->lock);
+    mem_free(pPriv);
+
+    return 0;
+}
+
+void trace_name(void *handle, const char *name)
+{
+    char *c = NULL;
+    trace_priv_t *pPriv = (trace_priv_t *)handle;
+    trace_ring_t *ring = __ring_get(pPriv);
+
+    if (ring == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pPriv->lock);
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    /* Kept out of the JSON strings */
+    for (c = ring->name; *c; c++) {
+        if (*c == '"' || *c == '\\' || (unsigned char)*c < ' ') {
+            *c = '_';
+        }
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+}
+
+void trace_event(void *handle, trace_event_e type, const void *job, const void *func, int arg)
+{
+    trace_priv_t *pPriv = (trace_priv_t *)handle;
+    trace_ring_t *ring = __ring_get(pPriv);
+    trace_rec_t *rec = NULL;
+
+    if (ring == NULL) {
+        return;
+    }
+
+    rec = &ring->recs[ring->head & (pPriv->size - 1)];
+    rec->ns = __now_ns();
+    rec->job = job;
+    rec->func = func;
+    rec->type = type;
+    rec->arg = arg;
+    /* Published after the record, dump only reads up to here */
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Write the events of one ring still there once copied, return how many */
+static size_t __ring_dump(trace_priv_t *pPriv, trace_ring_t *ring, trace_rec_t *copy,
+                          FILE *fp, int pid, size_t n_written)
+{
+    size_t i, begin, end, head;
+    char phase;
+    char extra[64];
+    trace_rec_t *rec = NULL;
+
+    end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    begin = end > pPriv->size ? end - pPriv->size : 0;
+    for (i = begin; i < end; i++) {
+        copy[i & (pPriv->size - 1)] = ring->recs[i & (pPriv->size - 1)];
+    }
+    /* Drop those the thread may have overwritten meanwhile */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (head >= pPriv->size && head - pPriv->size + 1 > begin) {
+        begin = head - pPriv->size + 1;
+    }
+
+    fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}", n_written ? ",\n" : "", pid, ring->tid, ring->name);
+    for (i = begin; i < end; i++) {
+        rec = &copy[i & (pPriv->size - 1)];
+        if (rec->type < 0 || rec->type >= TRACE_EVENT_NONE) {
+            continue;
+        }
+        /* Instant events are thread scoped, async ones pair up by id */
+        phase = s_trace_event[rec->type].phase[0];
+        if (phase == 'i') {
+            snprintf(extra, sizeof(extra), "\"s\":\"t\",");
+        } else if (phase == 'b' || phase == 'e') {
+            snprintf(extra, sizeof(extra), "\"cat\":\"%s\",\"id\":\"%p\",",
+                     s_trace_event[rec->type].name, rec->job);
+        } else {
+            extra[0] = '\0';
+        }
+        fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%s\",%s\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+                "\"args\":{\"job\":\"%p\",\"func\":\"%p\",\"arg\":%d}}",
+                s_trace_event[rec->type].name, s_trace_event[rec->type].phase, extra,
+                pid, ring->tid, rec->ns > pPriv->base ? (rec->ns - pPriv->base) / 1e3 : 0.0,
+                rec->job, rec->func, rec->arg);
+    }
+
+    return n_written + 1;
+}
+
+int trace_dump(void *handle, const char *path)
+{
+    size_t n = 0;
+    trace_priv_t *pPriv = (trace_priv_t *)handle;
+    trace_rec_t *copy = NULL;
+    list_t *p = NULL;
+    FILE *fp = NULL;
+
+    if (pPriv == NULL || path == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    copy = mem_alloc(pPriv->size * sizeof(trace_rec_t));
+    fp = fopen(path, "w");
+    if (copy == NULL || fp == NULL) {
+        errorf("open %s err\n", path);
+        mem_free(copy);
+        if (fp) {
+            fclose(fp);
+        }
+        return -1;
+    }
+
+    /* Threads keep recording, a ring is copied before it is written out */
+    fprintf(fp, "{\"traceEvents\":[\n");
+    pthread_mutex_lock(&pPriv->lock);
+    list_for_each(p, &pPriv->rings) {
+        n = __ring_dump(pPriv, list_entry(p, trace_ring_t, list), copy, fp, getpid(), n);
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    mem_free(copy);
+    return fclose(fp) ? -1 : 0;
+}
@@ -0,0 +1,404 @@
+#include "wheel.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "mem.h"
+
+#define WHEEL_TICK_US (1000)
+#define WHEEL_BATCH (64)
+#define WHEEL_BITS0 (8)
+#define WHEEL_BITS (6)
+#define WHEEL_SIZE0 (1 << WHEEL_BITS0)
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS (3)
+/* Ticks reachable without parking in the last slot of the top level */
+#define WHEEL_RANGE (1ULL << (WHEEL_BITS0 + WHEEL_LEVELS * WHEEL_BITS))
+
+typedef struct {
+    wheel_attr_t attr;
+    pthread_mutex_t lock;
+    pthread_cond_t event;
+    pthread_t thread;
+    int running;
+    uint64_t base;                  /* monotonic us of tick 0 */
+    uint64_t jiffies;               /* next tick to be processed */
+    uint64_t wake;                  /* tick the thread sleeps until */
+    int count;
+    uint64_t map0[WHEEL_SIZE0 / 64]; /* bit n set when slot0[n] is not empty */
+    list_t slot0[WHEEL_SIZE0];
+    list_t slot[WHEEL_LEVELS][WHEEL_SIZE];
+} wheel_priv_t;
+
+uint64_t wheel_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline wheel_link_t *__link(wheel_priv_t *pPriv, void *element)
+{
+    return (wheel_link_t *)((char *)element + pPriv->attr.offset);
+}
+
+/* Called with pPriv->lock held */
+static void __place(wheel_priv_t *pPriv, wheel_link_t *pLink)
+{
+    int level;
+    uint64_t expire = pLink->expire;
+    uint64_t delta = expire > pPriv->jiffies ? expire - pPriv->jiffies : 0;
+    size_t idx;
+
+    if (delta < WHEEL_SIZE0) {
+        /* Due already means due at the next tick */
+        idx = (delta ? expire : pPriv->jiffies) & (WHEEL_SIZE0 - 1);
+        list_add_tail(&pLink->list, &pPriv->slot0[idx]);
+        pPriv->map0[idx / 64] |= 1ULL << (idx % 64);
+        return;
+    }
+
+    if (delta >= WHEEL_RANGE) {
+        /* Parked as far as it goes, cascading places it again later */
+        expire = pPriv->jiffies + WHEEL_RANGE - 1;
+    }
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < 1ULL << (WHEEL_BITS0 + (level + 1) * WHEEL_BITS)) {
+            break;
+        }
+    }
+    idx = (expire >> (WHEEL_BITS0 + level * WHEEL_BITS)) & (WHEEL_SIZE - 1);
+    list_add_tail(&pLink->list, &pPriv->slot[level][idx]);
+}
+
+/* Called with pPriv->lock held */
+static void __unlink(wheel_priv_t *pPriv, wheel_link_t *pLink)
+{
+    size_t idx;
+    list_t *next = pLink->list.next;
+
+    list_del(&pLink->list);
+    pLink->owner = NULL;
+    pPriv->count--;
+
+    /* A level 0 slot that became empty has its bit cleared */
+    if (next == pLink->list.prev && next >= &pPriv->slot0[0] &&
+        next < &pPriv->slot0[WHEEL_SIZE0]) {
+        idx = next - &pPriv->slot0[0];
+        pPriv->map0[idx / 64] &= ~(1ULL << (idx % 64));
+    }
+}
+
+/* Move the elements of a higher level slot down to where they belong */
+static void __cascade(wheel_priv_t *pPriv, int level)
+{
+    size_t idx = (pPriv->jiffies >> (WHEEL_BITS0 + level * WHEEL_BITS)) & (WHEEL_SIZE - 1);
+    list_t moving;
+    list_t *p, *tmp;
+
+    INIT_LIST_HEAD(&moving);
+    list_splice(&pPriv->slot[level][idx], &moving);
+    INIT_LIST_HEAD(&pPriv->slot[level][idx]);
+    list_for_each_safe(p, tmp, &moving) {
+        __place(pPriv, list_entry(p, wheel_link_t, list));
+    }
+
+    if (idx == 0 && level + 1 < WHEEL_LEVELS) {
+        __cascade(pPriv, level + 1);
+    }
+}
+
+/* Called with pPriv->lock held, collect the elements of one tick */
+static void __tick(wheel_priv_t *pPriv, list_t *due)
+{
+    size_t idx = pPriv->jiffies & (WHEEL_SIZE0 - 1);
+    list_t *p, *tmp;
+    wheel_link_t *pLink = NULL;
+
+    if (idx == 0 && pPriv->jiffies) {
+        __cascade(pPriv, 0);
+    }
+
+    list_for_each_safe(p, tmp, &pPriv->slot0[idx]) {
+        pLink = list_entry(p, wheel_link_t, list);
+        list_del(p);
+        pLink->owner = NULL;
+        pPriv->count--;
+        list_add_tail(p, due);
+    }
+    pPriv->map0[idx / 64] &= ~(1ULL << (idx % 64));
+    pPriv->jiffies++;
+}
+
+/* The tick to wake up at, the next busy slot or the next cascade */
+static uint64_t __next_wake(wheel_priv_t *pPriv)
+{
+    size_t idx = pPriv->jiffies & (WHEEL_SIZE0 - 1);
+    size_t word;
+    uint64_t bits;
+
+    for (word = idx / 64; word < WHEEL_SIZE0 / 64; word++) {
+        bits = pPriv->map0[word];
+        if (word == idx / 64) {
+            bits &= ~0ULL << (idx % 64);
+        }
+        if (bits) {
+            return pPriv->jiffies - idx + word * 64 + __builtin_ctzll(bits);
+        }
+    }
+
+    return pPriv->jiffies - idx + WHEEL_SIZE0;
+}
+
+/* Called without the lock, cancel misses the elements from now on */
+static void __fire(wheel_priv_t *pPriv, list_t *due)
+{
+    int n = 0;
+    void *batch[WHEEL_BATCH];
+    list_t *p, *tmp;
+
+    list_for_each_safe(p, tmp, due) {
+        batch[n++] = (char *)list_entry(p, wheel_link_t, list) - pPriv->attr.offset;
+        if (n == WHEEL_BATCH) {
+            pPriv->attr.expire(pPriv->attr.arg, batch, n);
+            n = 0;
+        }
+    }
+    if (n) {
+        pPriv->attr.expire(pPriv->attr.arg, batch, n);
+    }
+}
+
+static void *__wheel_run(void *arg)
+{
+    wheel_priv_t *pPriv = arg;
+    uint64_t target, wake_us;
+    struct timespec ts;
+    list_t due;
+
+    pthread_mutex_lock(&pPriv->lock);
+    while (pPriv->running) {
+        INIT_LIST_HEAD(&due);
+        target = (wheel_now() - pPriv->base) / pPriv->attr.tick_us;
+        while (pPriv->jiffies <= target) {
+            __tick(pPriv, &due);
+        }
+
+        if (!list_empty(&due)) {
+            pthread_mutex_unlock(&pPriv->lock);
+            __fire(pPriv, &due);
+            pthread_mutex_lock(&pPriv->lock);
+            continue;
+        }
+
+        if (pPriv->count == 0) {
+            pPriv->wake = UINT64_MAX;
+            pthread_cond_wait(&pPriv->event, &pPriv->lock);
+            continue;
+        }
+
+        pPriv->wake = __next_wake(pPriv);
+        wake_us = pPriv->base + pPriv->wake * pPriv->attr.tick_us;
+        ts.tv_sec = wake_us / 1000000;
+        ts.tv_nsec = (wake_us % 1000000) * 1000;
+        pthread_cond_timedwait(&pPriv->event, &pPriv->lock, &ts);
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+
+    return NULL;
+}
+
+int wheel_create(const wheel_attr_t *attr, void **handle)
+{
+    int i, j, status;
+    pthread_condattr_t condattr;
+    wheel_priv_t *pPriv = NULL;
+
+    if (attr == NULL || attr->expire == NULL || handle == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    pPriv = (wheel_priv_t *)mem_alloc(sizeof(wheel_priv_t));
+    if (pPriv == NULL) {
+        errorf("mem_alloc err\n");
+        return -1;
+    }
+
+    memset(pPriv, 0, sizeof(wheel_priv_t));
+    memcpy(&pPriv->attr, attr, sizeof(wheel_attr_t));
+    if (pPriv->attr.tick_us == 0) {
+        pPriv->attr.tick_us = WHEEL_TICK_US;
+    }
+    for (i = 0; i < WHEEL_SIZE0; i++) {
+        INIT_LIST_HEAD(&pPriv->slot0[i]);
+    }
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_SIZE; j++) {
+            INIT_LIST_HEAD(&pPriv->slot[i][j]);
+        }
+    }
+    pPriv->base = wheel_now();
+    pPriv->wake = UINT64_MAX;
+    pPriv->running = 1;
+
+    pthread_mutex_init(&pPriv->lock, NULL);
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pPriv->event, &condattr);
+    pthread_condattr_destroy(&condattr);
+
+    status = pthread_create(&pPriv->thread, NULL, __wheel_run, pPriv);
+    if (status) {
+        errorf("pthread_create err\n");
+        pthread_cond_destroy(&pPriv->event);
+        pthread_mutex_destroy(&pPriv->lock);
+        mem_free(pPriv);
+        return -1;
+    }
+
+    *handle = pPriv;
+    return 0;
+}
+
+int wheel_delete(void *handle)
+{
+    int i, j;
+    wheel_priv_t *pPriv = handle;
+    list_t *p, *tmp;
+
+    if (pPriv == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&pPriv->lock);
+    pPriv->running = 0;
+    pthread_cond_signal(&pPriv->event);
+    pthread_mutex_unlock(&pPriv->lock);
+    pthread_join(pPriv->thread, NULL);
+
+    /* Elements still pending are dropped, not expired */
+    for (i = 0; i < WHEEL_SIZE0; i++) {
+        list_for_each_safe(p, tmp, &pPriv->slot0[i]) {
+            __unlink(pPriv, list_entry(p, wheel_link_t, list));
+        }
+    }
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_SIZE; j++) {
+            list_for_each_safe(p, tmp, &pPriv->slot[i][j]) {
+                __unlink(pPriv, list_entry(p, wheel_link_t, list));
+            }
+        }
+    }
+
+    pthread_cond_destroy(&pPriv->event);
+    pthread_mutex_destroy(&pPriv->lock);
+    mem_free(pPriv);
+
+    return 0;
+}
+
+int wheel_add(void *handle, void *element, uint64_t expire_us)
+{
+    uint64_t now;
+    wheel_priv_t *pPriv = handle;
+    wheel_link_t *pLink = NULL;
+
+    if (pPriv == NULL || element == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    pLink = __link(pPriv, element);
+    pthread_mutex_lock(&pPriv->lock);
+    if (pLink->owner) {
+        pthread_mutex_unlock(&pPriv->lock);
+        errorf("element %p already added\n", element);
+        return -1;
+    }
+
+    /* An empty wheel skips the idle ticks instead of walking them later */
+    if (pPriv->count == 0) {
+        now = (wheel_now() - pPriv->base) / pPriv->attr.tick_us;
+        pPriv->jiffies = now > pPriv->jiffies ? now : pPriv->jiffies;
+    }
+
+    /* Round up, an element never fires before its time */
+    expire_us = expire_us > pPriv->base ? expire_us - pPriv->base : 0;
+    pLink->expire = (expire_us + pPriv->attr.tick_us - 1) / pPriv->attr.tick_us;
+    pLink->owner = pPriv;
+    pPriv->count++;
+    __place(pPriv, pLink);
+
+    /* Only an element due before the planned wake up needs the thread */
+    if (pLink->expire < pPriv->wake) {
+        pPriv->wake = pLink->expire;
+        pthread_cond_signal(&pPriv->event);
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+
+    return 0;
+}
+
+int wheel_flush(void *handle)
+{
+    int i, j;
+    wheel_priv_t *pPriv = handle;
+    list_t due;
+    list_t *p, *tmp;
+
+    if (pPriv == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    /* Take every element at once, those added meanwhile wait their turn */
+    INIT_LIST_HEAD(&due);
+    pthread_mutex_lock(&pPriv->lock);
+    for (i = 0; i < WHEEL_SIZE0; i++) {
+        list_for_each_safe(p, tmp, &pPriv->slot0[i]) {
+            __unlink(pPriv, list_entry(p, wheel_link_t, list));
+            list_add_tail(p, &due);
+        }
+    }
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_SIZE; j++) {
+            list_for_each_safe(p, tmp, &pPriv->slot[i][j]) {
+                __unlink(pPriv, list_entry(p, wheel_link_t, list));
+                list_add_tail(p, &due);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+
+    __fire(pPriv, &due);
+
+    return 0;
+}
+
+int wheel_cancel(void *handle, void *element)
+{
+    int status = -1;
+    wheel_priv_t *pPriv = handle;
+    wheel_link_t *pLink = NULL;
+
+    if (pPriv == NULL || element == NULL) {
+        errorf("paramter err\n");
+        return -1;
+    }
+
+    pLink = __link(pPriv, element);
+    pthread_mutex_lock(&pPriv->lock);
+    if (pLink->owner == pPriv) {
+        __unlink(pPriv, pLink);
+        status = 0;
+    }
+    pthread_mutex_unlock(&pPriv->lock);
+
+    return status;
+}
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "taskpool.h"
+
+/*
+ * End to end benchmarks of the public API, one CSV row per case:
+ *   submit     producers add jobs without handles, then wait for all done
+ *   latency    one add_job, wait_job_done and del_job round trip
+ *   turnaround one add_job without handle, then wait_all_jobs_done
+ * Rows of two commits can be diffed as they are.
+ */
+
+#define BENCH_LIST_MAX (16)
+#define BENCH_PRODUCER_MAX (128)
+#define BENCH_WORKER_MAX (128)
+
+typedef struct {
+    int n;
+    long v[BENCH_LIST_MAX];
+} bench_list_t;
+
+typedef struct {
+    bench_list_t queues;
+    bench_list_t scheds;
+    bench_list_t workers;
+    bench_list_t producers;
+    bench_list_t sizes;         /* ns a job keeps the cpu busy */
+    long jobs;                  /* per submit case */
+    long samples;               /* per latency and turnaround case */
+    FILE *out;
+} bench_conf_t;
+
+typedef struct {
+    taskpool_t *pool;
+    long jobs;
+    long size;
+    pthread_barrier_t *barrier;
+    uint64_t start;             /* once released by the barrier */
+    uint64_t end;               /* once the last job is added */
+} bench_producer_t;
+
+static uint64_t __now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int __job(void *arg)
+{
+    uint64_t until;
+
+    if (arg == NULL) {
+        return 0;
+    }
+    until = __now_ns() + (long)arg;
+    while (__now_ns() < until) {
+    }
+
+    return 0;
+}
+
+static int __list_parse(bench_list_t *list, const char *str)
+{
+    char *end = NULL;
+
+    for (list->n = 0; list->n < BENCH_LIST_MAX; ) {
+        list->v[list->n++] = strtol(str, &end, 10);
+        if (end == str || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        if (*end == '\0') {
+            return 0;
+        }
+        str = end + 1;
+    }
+
+    return -1;
+}
+
+static int __list_check(const bench_list_t *list, long min, long max)
+{
+    int i;
+
+    for (i = 0; i < list->n; i++) {
+        if (list->v[i] < min || list->v[i] > max) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int __cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t __pct(const uint64_t *sorted, long n, double pct)
+{
+    long i = (long)(n * pct / 100);
+
+    return sorted[i < n ? i : n - 1];
+}
+
+static taskpool_t *__pool_create(long queue, long sched, long workers, long capacity)
+{
+    long i;
+    taskpool_attr_t attr = {};
+    taskpool_t *pool = NULL;
+
+    attr.queue_type = queue;
+    attr.sched_type = sched;
+    attr.queue_capacity = capacity;
+    pool = taskpool_init_ex(&attr);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < workers; i++) {
+        taskpool_worker_attr_t worker = {};
+        worker.type = TASKPOOL_WORKER_TYPE_THREAD;
+        if (pool->add_worker(pool, &worker)) {
+            pool->deinit(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+static void *__producer(void *arg)
+{
+    long i;
+    bench_producer_t *producer = arg;
+    taskpool_job_attr_t attr = {};
+
+    attr.type = TASKPOOL_WORKER_TYPE_THREAD;
+    attr.func = __job;
+    attr.arg = (void *)producer->size;
+    pthread_barrier_wait(producer->barrier);
+    producer->start = __now_ns();
+    for (i = 0; i < producer->jobs; i++) {
+        while (producer->pool->add_job(producer->pool, &attr, NULL)) {
+            sched_yield();
+        }
+    }
+    producer->end = __now_ns();
+
+    return NULL;
+}
+
+static void __bench_submit(const bench_conf_t *conf, long queue, long sched,
+                           long workers, long producers, long size)
+{
+    long i, jobs;
+    uint64_t start, submitted, done;
+    taskpool_t *pool = __pool_create(queue, sched, workers, conf->jobs);
+    pthread_t threads[BENCH_PRODUCER_MAX];
+    bench_producer_t producer[BENCH_PRODUCER_MAX];
+    pthread_barrier_t barrier;
+
+    assert(pool);
+    pthread_barrier_init(&barrier, NULL, producers + 1);
+    jobs = conf->jobs / producers;
+    for (i = 0; i < producers; i++) {
+        producer[i].pool = pool;
+        producer[i].jobs = jobs;
+        producer[i].size = size;
+        producer[i].barrier = &barrier;
+        pthread_create(&threads[i], NULL, __producer, &producer[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pool->wait_all_jobs_done(pool);
+    done = __now_ns();
+
+    /* Timed by the producers, main may only get the cpu after they are done */
+    start = producer[0].start;
+    submitted = producer[0].end;
+    for (i = 1; i < producers; i++) {
+        start = producer[i].start < start ? producer[i].start : start;
+        submitted = producer[i].end > submitted ? producer[i].end : submitted;
+    }
+    submitted = submitted > start ? submitted : start + 1;
+
+    fprintf(conf->out, "submit,%ld,%ld,%ld,%ld,%ld,%ld,%.0f,%.0f,,,,%.3f\n",
+            queue, sched, workers, producers, size, jobs * producers,
+            jobs * producers * 1e9 / (submitted - start),
+            jobs * producers * 1e9 / (done - start), (done - start) / 1e6);
+    fflush(conf->out);
+    pthread_barrier_destroy(&barrier);
+    pool->deinit(pool);
+}
+
+static void __bench_round(const bench_conf_t *conf, long queue, long sched,
+                          long workers, long size, int turnaround)
+{
+    long i;
+    uint64_t start, total;
+    uint64_t *lat = malloc(conf->samples * sizeof(uint64_t));
+    taskpool_t *pool = __pool_create(queue, sched, workers, 0);
+    taskpool_job_attr_t attr = {};
+    job_t job;
+
+    assert(pool && lat);
+    attr.type = TASKPOOL_WORKER_TYPE_THREAD;
+    attr.func = __job;
+    attr.arg = (void *)size;
+
+    total = __now_ns();
+    for (i = 0; i < conf->samples; i++) {
+        start = __now_ns();
+        if (pool->add_job(pool, &attr, turnaround ? NULL : &job)) {
+            fprintf(stderr, "add_job err\n");
+            exit(1);
+        }
+        if (turnaround) {
+            pool->wait_all_jobs_done(pool);
+        } else {
+            pool->wait_job_done(pool, job);
+            pool->del_job(pool, job);
+        }
+        lat[i] = __now_ns() - start;
+    }
+    total = __now_ns() - total;
+    qsort(lat, conf->samples, sizeof(uint64_t), __cmp);
+
+    fprintf(conf->out, "%s,%ld,%ld,%ld,1,%ld,%ld,%.0f,%.0f,%lu,%lu,%lu,%.3f\n",
+            turnaround ? "turnaround" : "latency", queue, sched, workers, size,
+            conf->samples, conf->samples * 1e9 / total, conf->samples * 1e9 / total,
+            (unsigned long)__pct(lat, conf->samples, 50),
+            (unsigned long)__pct(lat, conf->samples, 99),
+            (unsigned long)__pct(lat, conf->samples, 99.9), total / 1e6);
+    fflush(conf->out);
+    free(lat);
+    pool->deinit(pool);
+}
+
+static void __usage(const char *name)
+{
+    printf("Usage: %s [options], a list is comma separated\n", name);
+    printf("  -q list  queue types, 0 list, 1 ring (default 0,1)\n");
+    printf("  -t list  sched types, 0 shared, 1 steal (default 0,1)\n");
+    printf("  -w list  worker counts, 1 to %d (default 1,2,4)\n", BENCH_WORKER_MAX);
+    printf("  -p list  producer counts of the submit case, 1 to %d (default 1,2,4)\n",
+           BENCH_PRODUCER_MAX);
+    printf("  -s list  ns of cpu each job burns (default 0,1000)\n");
+    printf("  -n num   jobs of a submit case (default 200000)\n");
+    printf("  -l num   samples of a latency or turnaround case (default 20000)\n");
+    printf("  -o file  write the rows to file instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, q, t, w, p, s;
+    bench_conf_t conf = {};
+    bench_list_t *list = NULL;
+
+    __list_parse(&conf.queues, "0,1");
+    __list_parse(&conf.scheds, "0,1");
+    __list_parse(&conf.workers, "1,2,4");
+    __list_parse(&conf.producers, "1,2,4");
+    __list_parse(&conf.sizes, "0,1000");
+    conf.jobs = 200000;
+    conf.samples = 20000;
+    conf.out = stdout;
+
+    while ((opt = getopt(argc, argv, "q:t:w:p:s:n:l:o:h")) != -1) {
+        list = NULL;
+        switch (opt) {
+        case 'q': list = &conf.queues; break;
+        case 't': list = &conf.scheds; break;
+        case 'w': list = &conf.workers; break;
+        case 'p': list = &conf.producers; break;
+        case 's': list = &conf.sizes; break;
+        case 'n': conf.jobs = atol(optarg); break;
+        case 'l': conf.samples = atol(optarg); break;
+        case 'o':
+            conf.out = fopen(optarg, "w");
+            if (conf.out == NULL) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            __usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+        if (list && __list_parse(list, optarg)) {
+            __usage(argv[0]);
+            return 1;
+        }
+    }
+    /* No worker at all would leave the cases waiting forever */
+    if (conf.jobs <= 0 || conf.samples <= 0 ||
+        __list_check(&conf.queues, 0, TASKPOOL_QUEUE_TYPE_NONE - 1) ||
+        __list_check(&conf.scheds, 0, TASKPOOL_SCHED_TYPE_NONE - 1) ||
+        __list_check(&conf.workers, 1, BENCH_WORKER_MAX) ||
+        __list_check(&conf.producers, 1, BENCH_PRODUCER_MAX) ||
+        __list_check(&conf.sizes, 0, LONG_MAX)) {
+        __usage(argv[0]);
+        return 1;
+    }
+
+    /* ops_per_s is the submit rate and done_per_s the completion rate */
+    fprintf(conf.out, "case,queue,sched,workers,producers,job_ns,ops,"
+            "ops_per_s,done_per_s,p50_ns,p99_ns,p999_ns,total_ms\n");
+    for (q = 0; q < conf.queues.n; q++) {
+        for (t = 0; t < conf.scheds.n; t++) {
+            for (w = 0; w < conf.workers.n; w++) {
+                for (s = 0; s < conf.sizes.n; s++) {
+                    for (p = 0; p < conf.producers.n; p++) {
+                        __bench_submit(&conf, conf.queues.v[q], conf.scheds.v[t],
+                                       conf.workers.v[w], conf.producers.v[p],
+                                       conf.sizes.v[s]);
+                    }
+                    __bench_round(&conf, conf.queues.v[q], conf.scheds.v[t],
+                                  conf.workers.v[w], conf.sizes.v[s], 0);
+                    __bench_round(&conf, conf.queues.v[q], conf.scheds.v[t],
+                                  conf.workers.v[w], conf.sizes.v[s], 1);
+                }
+            }
+        }
+    }
+
+    if (conf.out != stdout) {
+        fclose(conf.out);
+    }
+
+    return 0;
+}
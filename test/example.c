@@ -1,5 +1,9 @@
+/* The asserts are the checks of the example, keep them in release builds */
+#undef NDEBUG
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
+#include <string.h>
 #include <unistd.h>
 #include "taskpool.h"
 
@@ -11,6 +15,7 @@ const char *status_str[] = {
     "TODO",
     "DOING",
     "DONE",
+    "CANCELED",
 };
 
 static int func(void *arg)
@@ -21,11 +26,608 @@ static int func(void *arg)
     return 0;
 }
 
+static int tick(void *arg)
+{
+    printf("tick\n");
+    return 0;
+}
+
+static void sum(size_t begin, size_t end, void *value, void *ctx)
+{
+    for (; begin < end; begin++) {
+        *(unsigned long *)value += begin;
+    }
+}
+
+static void add(void *value, const void *other, void *ctx)
+{
+    *(unsigned long *)value += *(const unsigned long *)other;
+}
+
+typedef struct {
+    taskpool_t *pool;
+    int done;
+    int full;
+} example_ctx_t;
+
+static int count(void *arg)
+{
+    __atomic_fetch_add(&((example_ctx_t *)arg)->done, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int busy(void *arg)
+{
+    usleep(1000);
+    return count(arg);
+}
+
+#define RING_CAPACITY (8)
+#define RING_JOBS     (100)
+
+static void *producer(void *arg)
+{
+    int i;
+    example_ctx_t *ctx = arg;
+    taskpool_job_attr_t attr = {};
+    attr.type = TASKPOOL_WORKER_TYPE_THREAD;
+    attr.func = busy;
+    attr.arg = ctx;
+
+    for (i = 0; i < RING_JOBS; i++) {
+        /* A full ring turns the job down, try again once the workers made room */
+        while (ctx->pool->add_job(ctx->pool, &attr, NULL)) {
+            __atomic_fetch_add(&ctx->full, 1, __ATOMIC_RELAXED);
+            usleep(5000);
+        }
+    }
+
+    return NULL;
+}
+
+static void example_ring(void)
+{
+    int i, ret;
+    pthread_t producers[2];
+    example_ctx_t ctx = {};
+    taskpool_attr_t attr = {};
+    taskpool_worker_attr_t worker = {};
+
+    printf("Fill a ring of %d from 2 producers, delete 2 of 3 workers meanwhile\n",
+           RING_CAPACITY);
+    attr.queue_type = TASKPOOL_QUEUE_TYPE_RING;
+    attr.queue_capacity = RING_CAPACITY;
+    ctx.pool = taskpool_init_ex(&attr);
+    assert(ctx.pool);
+    worker.type = TASKPOOL_WORKER_TYPE_THREAD;
+    for (i = 0; i < 3; i++) {
+        ret = ctx.pool->add_worker(ctx.pool, &worker);
+        assert(ret == 0);
+    }
+    for (i = 0; i < 2; i++) {
+        ret = pthread_create(&producers[i], NULL, producer, &ctx);
+        assert(ret == 0);
+    }
+    /* The exit of a worker does not queue behind the backlog of the full ring */
+    for (i = 0; i < 2; i++) {
+        usleep(20000);
+        ret = ctx.pool->del_worker(ctx.pool, &worker);
+        assert(ret == 0);
+    }
+    for (i = 0; i < 2; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    ret = ctx.pool->wait_all_jobs_done(ctx.pool);
+    assert(ret == 0);
+    printf("%d jobs done, the ring was full %d times\n", ctx.done, ctx.full);
+    assert(ctx.done == 2 * RING_JOBS);
+    ret = ctx.pool->deinit(ctx.pool);
+    assert(ret == 0);
+}
+
+#define STEAL_CHILDREN (100)
+
+static int spawn(void *arg)
+{
+    int i;
+    example_ctx_t *ctx = arg;
+    taskpool_job_attr_t attr = {};
+    attr.type = TASKPOOL_WORKER_TYPE_THREAD;
+    attr.func = count;
+    attr.arg = ctx;
+
+    /* Pushed on the deque of this worker, the others steal from it */
+    for (i = 0; i < STEAL_CHILDREN; i++) {
+        if (ctx->pool->add_job(ctx->pool, &attr, NULL)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void example_steal(void)
+{
+    int i, ret;
+    example_ctx_t ctx = {};
+    taskpool_attr_t attr = {};
+    taskpool_worker_attr_t worker = {};
+    taskpool_job_attr_t job = {};
+
+    printf("Spawn %d jobs from 2 jobs on 4 stealing workers\n", 2 * STEAL_CHILDREN);
+    attr.sched_type = TASKPOOL_SCHED_TYPE_STEAL;
+    ctx.pool = taskpool_init_ex(&attr);
+    assert(ctx.pool);
+    worker.type = TASKPOOL_WORKER_TYPE_THREAD;
+    for (i = 0; i < 4; i++) {
+        ret = ctx.pool->add_worker(ctx.pool, &worker);
+        assert(ret == 0);
+    }
+    job.type = TASKPOOL_WORKER_TYPE_THREAD;
+    job.func = spawn;
+    job.arg = &ctx;
+    for (i = 0; i < 2; i++) {
+        ret = ctx.pool->add_job(ctx.pool, &job, NULL);
+        assert(ret == 0);
+    }
+    ret = ctx.pool->wait_all_jobs_done(ctx.pool);
+    assert(ret == 0 && ctx.done == 2 * STEAL_CHILDREN);
+    ret = ctx.pool->deinit(ctx.pool);
+    assert(ret == 0);
+}
+
+static void example_add_jobs(void)
+{
+    int i, ret;
+    example_ctx_t ctx = {};
+    job_t handles[JOBS];
+    taskpool_job_attr_t attrs[JOBS];
+    taskpool_job_status_t status;
+    taskpool_worker_attr_t worker = {};
+
+    printf("Add %d jobs in one batch\n", JOBS);
+    ctx.pool = taskpool_init();
+    assert(ctx.pool);
+    worker.type = TASKPOOL_WORKER_TYPE_THREAD;
+    for (i = 0; i < 2; i++) {
+        ret = ctx.pool->add_worker(ctx.pool, &worker);
+        assert(ret == 0);
+    }
+    memset(attrs, 0, sizeof(attrs));
+    for (i = 0; i < JOBS; i++) {
+        attrs[i].type = TASKPOOL_WORKER_TYPE_THREAD;
+        attrs[i].func = count;
+        attrs[i].arg = &ctx;
+    }
+    ret = ctx.pool->add_jobs(ctx.pool, attrs, JOBS, handles);
+    assert(ret == 0);
+    for (i = 0; i < JOBS; i++) {
+        ret = ctx.pool->wait_job_done(ctx.pool, handles[i]);
+        assert(ret == 0);
+        ret = ctx.pool->get_job_status(ctx.pool, handles[i], &status);
+        assert(ret == 0 && status.status == TASKPOOL_JOB_STATUS_DONE);
+        ret = ctx.pool->del_job(ctx.pool, handles[i]);
+        assert(ret == 0);
+    }
+    assert(ctx.done == JOBS);
+    ret = ctx.pool->deinit(ctx.pool);
+    assert(ret == 0);
+}
+
+static int yielder(void *arg)
+{
+    int i;
+
+    /* The other coroutines of the carrier thread run at each yield */
+    for (i = 0; i < 10; i++) {
+        if (taskpool_yield()) {
+            return -1;
+        }
+    }
+
+    return count(arg);
+}
+
+static void example_coroutine(void)
+{
+    int i, ret;
+    example_ctx_t ctx = {};
+    taskpool_worker_attr_t worker = {};
+    taskpool_job_attr_t job = {};
+
+    printf("Run %d yielding jobs on 2 coroutine workers\n", JOBS);
+    ctx.pool = taskpool_init();
+    assert(ctx.pool);
+    worker.type = TASKPOOL_WORKER_TYPE_COROUTINE;
+    for (i = 0; i < 2; i++) {
+        ret = ctx.pool->add_worker(ctx.pool, &worker);
+        assert(ret == 0);
+    }
+    job.type = TASKPOOL_WORKER_TYPE_COROUTINE;
+    job.func = yielder;
+    job.arg = &ctx;
+    for (i = 0; i < JOBS; i++) {
+        ret = ctx.pool->add_job(ctx.pool, &job, NULL);
+        assert(ret == 0);
+    }
+    ret = ctx.pool->wait_all_jobs_done(ctx.pool);
+    assert(ret == 0 && ctx.done == JOBS);
+    ret = ctx.pool->deinit(ctx.pool);
+    assert(ret == 0);
+}
+
+typedef struct {
+    taskpool_t *pool;
+    job_t job;
+    int ret;
+} waiter_ctx_t;
+
+static int nap(void *arg)
+{
+    usleep((unsigned long)arg * 10000);
+    return 0;
+}
+
+static void *waiter(void *arg)
+{
+    waiter_ctx_t *ctx = arg;
+
+    ctx->ret = ctx->pool->wait_job_done(ctx->pool, ctx->job);
+    return NULL;
+}
+
+static void example_waiters(void)
+{
+    int i, ret;
+    taskpool_t *pool = NULL;
+    pthread_t threads[4];
+    waiter_ctx_t waiters[4];
+    taskpool_job_status_t status;
+    taskpool_worker_attr_t worker = {};
+    taskpool_job_attr_t job = {};
+
+    printf("Wait for 4 jobs from 4 threads, the last one added ends first\n");
+    pool = taskpool_init();
+    assert(pool);
+    worker.type = TASKPOOL_WORKER_TYPE_THREAD;
+    for (i = 0; i < 4; i++) {
+        ret = pool->add_worker(pool, &worker);
+        assert(ret == 0);
+    }
+    job.type = TASKPOOL_WORKER_TYPE_THREAD;
+    job.func = nap;
+    for (i = 0; i < 4; i++) {
+        job.arg = (void *)(unsigned long)(4 - i);
+        waiters[i].pool = pool;
+        ret = pool->add_job(pool, &job, &waiters[i].job);
+        assert(ret == 0);
+        ret = pthread_create(&threads[i], NULL, waiter, &waiters[i]);
+        assert(ret == 0);
+    }
+    /* Each waiter is woken by its own job, not by the others */
+    for (i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        assert(waiters[i].ret == 0);
+        ret = pool->get_job_status(pool, waiters[i].job, &status);
+        assert(ret == 0 && status.status == TASKPOOL_JOB_STATUS_DONE);
+    }
+    ret = pool->deinit(pool);
+    assert(ret == 0);
+}
+
+#define AGING_HIGH (8)
+
+static int s_order[AGING_HIGH + 1];
+static int s_n_order;
+
+static int gate(void *arg)
+{
+    usleep(100000);
+    return 0;
+}
+
+static int record(void *arg)
+{
+    s_order[s_n_order++] = (long)arg;
+    return 0;
+}
+
+/* Return the place the low priority job ran at among the others */
+static int aging_place(int aging)
+{
+    int i, ret;
+    job_t blocker;
+    taskpool_t *pool = NULL;
+    taskpool_attr_t attr = {};
+    taskpool_job_status_t status;
+    taskpool_worker_attr_t worker = {};
+    taskpool_job_attr_t job = {};
+
+    attr.priority_aging = aging;
+    pool = taskpool_init_ex(&attr);
+    assert(pool);
+    worker.type = TASKPOOL_WORKER_TYPE_THREAD;
+    ret = pool->add_worker(pool, &worker);
+    assert(ret == 0);
+
+    /* Hold the only worker until every job is queued */
+    job.type = TASKPOOL_WORKER_TYPE_THREAD;
+    job.func = gate;
+    ret = pool->add_job(pool, &job, &blocker);
+    assert(ret == 0);
+    do {
+        usleep(1000);
+        ret = pool->get_job_status(pool, blocker, &status);
+        assert(ret == 0);
+    } while (status.status == TASKPOOL_JOB_STATUS_TODO);
+
+    s_n_order = 0;
+    job.func = record;
+    job.priority = 0;
+    job.arg = (void *)0L;
+    ret = pool->add_job(pool, &job, NULL);
+    assert(ret == 0);
+    job.priority = TASKPOOL_JOB_PRIORITY_NUM - 1;
+    for (i = 1; i <= AGING_HIGH; i++) {
+        job.arg = (void *)(long)i;
+        ret = pool->add_job(pool, &job, NULL);
+        assert(ret == 0);
+    }
+    ret = pool->wait_all_jobs_done(pool);
+    assert(ret == 0 && s_n_order == AGING_HIGH + 1);
+    ret = pool->deinit(pool);
+    assert(ret == 0);
+
+    for (i = 0; s_order[i]; i++) {
+    }
+    return i;
+}
+
+static void example_aging(void)
+{
+    int place;
+
+    printf("Queue a low priority job before %d high ones\n", AGING_HIGH);
+    place = aging_place(0);
+    printf("strict order runs it at %d\n", place);
+    assert(place == AGING_HIGH);
+    place = aging_place(4);
+    printf("priority_aging 4 runs it at %d\n", place);
+    assert(place < AGING_HIGH);
+}
+
+static void example_idle(void)
+{
+    int i, ret;
+    example_ctx_t ctx = {};
+    taskpool_attr_t attr = {};
+    taskpool_worker_attr_t worker = {};
+    taskpool_job_attr_t job = {};
+
+    printf("Wake parked workers for %d jobs\n", JOBS);
+    attr.idle_spin = 100;
+    attr.idle_yield = 10;
+    ctx.pool = taskpool_init_ex(&attr);
+    assert(ctx.pool);
+    worker.type = TASKPOOL_WORKER_TYPE_THREAD;
+    for (i = 0; i < 2; i++) {
+        ret = ctx.pool->add_worker(ctx.pool, &worker);
+        assert(ret == 0);
+    }
+    job.type = TASKPOOL_WORKER_TYPE_THREAD;
+    job.func = count;
+    job.arg = &ctx;
+    for (i = 0; i < JOBS; i++) {
+        /* Long enough a break for the workers to spin, yield, then park */
+        usleep(i % 5 ? 0 : 20000);
+        ret = ctx.pool->add_job(ctx.pool, &job, NULL);
+        assert(ret == 0);
+    }
+    ret = ctx.pool->wait_all_jobs_done(ctx.pool);
+    assert(ret == 0 && ctx.done == JOBS);
+    ret = ctx.pool->deinit(ctx.pool);
+    assert(ret == 0);
+}
+
+static int slow(void *arg)
+{
+    usleep(5000);
+    return 0;
+}
+
+static void example_autoscale(void)
+{
+    int i, ret;
+    size_t most = 0;
+    taskpool_t *pool = NULL;
+    taskpool_stats_t stats = {};
+    taskpool_group_attr_t group = {};
+    taskpool_job_attr_t job = {};
+
+    printf("Scale a group of 1 ~ 4 workers with the queue depth\n");
+    pool = taskpool_init();
+    assert(pool);
+    group.name = "scaled";
+    group.type = TASKPOOL_WORKER_TYPE_THREAD;
+    group.sys_cpu_mask = 1;
+    group.min_workers = 1;
+    group.max_workers = 4;
+    group.scale_depth = 2;
+    group.idle_timeout_ms = 50;
+    ret = pool->add_group(pool, &group);
+    assert(ret == 0);
+
+    /* The jobs asking for cpu 0 go to the group */
+    job.type = TASKPOOL_WORKER_TYPE_THREAD;
+    job.sys_cpu_mask = 1;
+    job.func = slow;
+    for (i = 0; i < 4 * JOBS; i++) {
+        ret = pool->add_job(pool, &job, NULL);
+        assert(ret == 0);
+    }
+    do {
+        ret = pool->get_stats(pool, &stats);
+        assert(ret == 0);
+        most = stats.n_workers > most ? stats.n_workers : most;
+        usleep(5000);
+    } while (stats.pending);
+    printf("grew to %zu workers\n", most);
+    assert(most > 1);
+
+    /* Idle ones retire down to min_workers */
+    for (i = 0; i < 200 && stats.n_workers > 1; i++) {
+        usleep(10000);
+        ret = pool->get_stats(pool, &stats);
+        assert(ret == 0);
+    }
+    printf("shrank to %zu workers\n", stats.n_workers);
+    assert(stats.n_workers == 1);
+    ret = pool->deinit(pool);
+    assert(ret == 0);
+}
+
+static void example_cancel_drain(void)
+{
+    int i, ret;
+    job_t blocker;
+    example_ctx_t ctx = {};
+    taskpool_attr_t attr = {};
+    taskpool_job_status_t status;
+    taskpool_worker_attr_t worker = {};
+    taskpool_job_attr_t job = {};
+
+    printf("Deinit a pool that cancels its %d pending jobs\n", JOBS);
+    attr.drain_type = TASKPOOL_DRAIN_TYPE_CANCEL;
+    ctx.pool = taskpool_init_ex(&attr);
+    assert(ctx.pool);
+    worker.type = TASKPOOL_WORKER_TYPE_THREAD;
+    ret = ctx.pool->add_worker(ctx.pool, &worker);
+    assert(ret == 0);
+
+    job.type = TASKPOOL_WORKER_TYPE_THREAD;
+    job.func = gate;
+    ret = ctx.pool->add_job(ctx.pool, &job, &blocker);
+    assert(ret == 0);
+    do {
+        usleep(1000);
+        ret = ctx.pool->get_job_status(ctx.pool, blocker, &status);
+        assert(ret == 0);
+    } while (status.status == TASKPOOL_JOB_STATUS_TODO);
+
+    job.func = count;
+    job.arg = &ctx;
+    for (i = 0; i < JOBS; i++) {
+        ret = ctx.pool->add_job(ctx.pool, &job, NULL);
+        assert(ret == 0);
+    }
+    /* The running job finishes, the queued ones never start */
+    ret = ctx.pool->deinit(ctx.pool);
+    assert(ret == 0 && ctx.done == 0);
+}
+
+static int fail(void *arg)
+{
+    return -1;
+}
+
+static void example_stats(void)
+{
+    int i, ret;
+    size_t runs = 0, timed = 0;
+    example_ctx_t ctx = {};
+    taskpool_attr_t attr = {};
+    taskpool_stats_t stats = {};
+    taskpool_worker_stats_t workers[4];
+    taskpool_worker_attr_t worker = {};
+    taskpool_job_attr_t job = {};
+
+    printf("Count %d jobs, one of them failing\n", JOBS);
+    attr.timing = 1;
+    ctx.pool = taskpool_init_ex(&attr);
+    assert(ctx.pool);
+    worker.type = TASKPOOL_WORKER_TYPE_THREAD;
+    for (i = 0; i < 2; i++) {
+        ret = ctx.pool->add_worker(ctx.pool, &worker);
+        assert(ret == 0);
+    }
+    job.type = TASKPOOL_WORKER_TYPE_THREAD;
+    job.arg = &ctx;
+    for (i = 0; i < JOBS; i++) {
+        job.func = i ? count : fail;
+        ret = ctx.pool->add_job(ctx.pool, &job, NULL);
+        assert(ret == 0);
+    }
+    ret = ctx.pool->wait_all_jobs_done(ctx.pool);
+    assert(ret == 0);
+
+    stats.workers = workers;
+    stats.max_workers = sizeof(workers) / sizeof(workers[0]);
+    ret = ctx.pool->get_stats(ctx.pool, &stats);
+    assert(ret == 0);
+    printf("submitted %zu, completed %zu, failed %zu, %zu workers\n",
+           stats.submitted, stats.completed, stats.failed, stats.n_workers);
+    assert(stats.submitted == JOBS && stats.completed == JOBS && stats.failed == 1);
+    assert(stats.pending == 0 && stats.queue_depth == 0 && stats.n_workers == 2);
+    for (i = 0; i < stats.n_workers; i++) {
+        runs += workers[i].runs;
+    }
+    for (i = 0; i < TASKPOOL_STATS_BUCKETS; i++) {
+        timed += stats.run_ns[i];
+    }
+    assert(runs == JOBS && timed == JOBS);
+    ret = ctx.pool->deinit(ctx.pool);
+    assert(ret == 0);
+}
+
+#define TRACE_PATH "example_trace.json"
+
+static void example_trace(void)
+{
+    int i, ret;
+    char head[32] = {};
+    FILE *fp = NULL;
+    example_ctx_t ctx = {};
+    taskpool_attr_t attr = {};
+    taskpool_worker_attr_t worker = {};
+    taskpool_job_attr_t job = {};
+
+    printf("Trace jobs on a thread and a coroutine worker to %s\n", TRACE_PATH);
+    attr.trace_events = 256;
+    ctx.pool = taskpool_init_ex(&attr);
+    assert(ctx.pool);
+    for (i = 0; i < TASKPOOL_WORKER_TYPE_NONE; i++) {
+        worker.type = i;
+        ret = ctx.pool->add_worker(ctx.pool, &worker);
+        assert(ret == 0);
+    }
+    job.arg = &ctx;
+    for (i = 0; i < JOBS; i++) {
+        job.type = i % TASKPOOL_WORKER_TYPE_NONE;
+        job.func = job.type == TASKPOOL_WORKER_TYPE_COROUTINE ? yielder : count;
+        ret = ctx.pool->add_job(ctx.pool, &job, NULL);
+        assert(ret == 0);
+    }
+    ret = ctx.pool->wait_all_jobs_done(ctx.pool);
+    assert(ret == 0 && ctx.done == JOBS);
+    ret = ctx.pool->dump_trace(ctx.pool, TRACE_PATH);
+    assert(ret == 0);
+
+    fp = fopen(TRACE_PATH, "r");
+    assert(fp);
+    ret = fread(head, 1, sizeof(head) - 1, fp);
+    fclose(fp);
+    assert(ret > 0 && strstr(head, "traceEvents"));
+    remove(TRACE_PATH);
+    ret = ctx.pool->deinit(ctx.pool);
+    assert(ret == 0);
+}
+
 int main()
 {
     int workers = WORKERS;
     int jobs = JOBS;
     unsigned long i;
+    unsigned long total = 0;
     int ret = 0;
     taskpool_t *pObj = taskpool_init();
     assert(pObj);
@@ -88,6 +690,12 @@ int main()
         printf("job[%p]: %s\n", j_handles[i], status_str[status.status]);
     }
 
+    printf("Delete %d done jobs\n", JOBS);
+    for (i = 0; i < jobs; i++) {
+        ret = pObj->del_job(pObj, j_handles[i]);
+        assert(ret == 0);
+    }
+
     printf("Add %d jobs\n", JOBS);
     for (i = 0; i < jobs; i++) {
         taskpool_job_attr_t attr = {};
@@ -105,9 +713,70 @@ int main()
         sleep(i%3);
     }
 
+    printf("Delete %d deleted jobs, their handles are stale\n", JOBS);
+    for (i = 0; i < jobs; i++) {
+        taskpool_job_status_t status;
+        ret = pObj->del_job(pObj, j_handles[i]);
+        assert(ret == -1);
+        ret = pObj->get_job_status(pObj, j_handles[i], &status);
+        assert(ret == -1);
+    }
+
+    printf("Add a job after 2 others, then one more after it\n");
+    {
+        void *deps[3];
+        taskpool_job_status_t status;
+        taskpool_job_attr_t attr = {};
+        attr.type = TASKPOOL_WORKER_TYPE_THREAD;
+        attr.func = tick;
+        for (i = 0; i < 2; i++) {
+            ret = pObj->add_job(pObj, &attr, &deps[i]);
+            assert(ret == 0);
+        }
+        ret = pObj->add_job_after(pObj, &attr, deps, 2, &deps[2]);
+        assert(ret == 0);
+        ret = pObj->then(pObj, deps[2], &attr, &j_handles[0]);
+        assert(ret == 0);
+        ret = pObj->wait_job_done(pObj, j_handles[0]);
+        assert(ret == 0);
+        for (i = 0; i < 3; i++) {
+            ret = pObj->get_job_status(pObj, deps[i], &status);
+            assert(ret == 0 && status.status == TASKPOOL_JOB_STATUS_DONE);
+            ret = pObj->del_job(pObj, deps[i]);
+            assert(ret == 0);
+        }
+        ret = pObj->del_job(pObj, j_handles[0]);
+        assert(ret == 0);
+    }
+
+    printf("Sum 0 ~ %d in parallel\n", 1000000 - 1);
+    ret = pObj->parallel_reduce(pObj, 0, 1000000, 0, &total, sizeof(total), sum, add, NULL);
+    assert(ret == 0 && total == 1000000UL * (1000000 - 1) / 2);
+
+    printf("Add a job every hour, deinit runs it once more at once\n");
+    {
+        taskpool_job_attr_t attr = {};
+        attr.type = TASKPOOL_WORKER_TYPE_THREAD;
+        attr.func = tick;
+        ret = pObj->add_timed_job(pObj, &attr, 3600 * 1000, 3600 * 1000, NULL);
+        assert(ret == 0);
+    }
+
     printf("Destroy taskpool\n");
     ret = pObj->deinit(pObj);
     assert(ret == 0);
 
+    example_ring();
+    example_steal();
+    example_add_jobs();
+    example_coroutine();
+    example_waiters();
+    example_aging();
+    example_idle();
+    example_autoscale();
+    example_cancel_drain();
+    example_stats();
+    example_trace();
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "mem.h"
+#include "que.h"
+
+/*
+ * Microbenchmarks of the primitives under every job, one CSV row per case:
+ *   mem_pair   each thread allocates a batch of one size, then frees it,
+ *              with mem_alloc/mem_free and with malloc/free
+ *   que_st     one thread puts a batch, then gets it back
+ *   que_spsc   one producer, one consumer
+ *   que_mpmc   as many producers as consumers
+ *   que_remove one thread removes queued elements in random order
+ * cycles_per_op adds up the time stamp counter ticks every thread spent on
+ * the case, 0 where there is no counter. cache_hit_pct is the share of the
+ * mem_alloc/mem_free calls of a mem case served by the thread cache without
+ * visiting the depot, empty for the other cases.
+ */
+
+#define BENCH_LIST_MAX (16)
+#define BENCH_BATCH (64)
+#define BENCH_REMOVE_MAX (4096)
+
+typedef struct {
+    int n;
+    long v[BENCH_LIST_MAX];
+} bench_list_t;
+
+typedef struct {
+    bench_list_t sizes;
+    bench_list_t threads;
+    long ops;                   /* per case, split among the threads */
+    FILE *out;
+} bench_conf_t;
+
+typedef struct {
+    que_link_t link;
+    long seq;
+} bench_elem_t;
+
+typedef struct bench_case {
+    void (*func)(struct bench_case *bench, int id);
+    pthread_barrier_t start;
+    int n_threads;
+    long ops;                   /* per thread */
+    size_t size;
+    int use_malloc;
+    void *que;
+    bench_elem_t *elems;
+    int n_producers;
+    long got;                   /* elements taken by all consumers */
+    mem_stat_t stat;            /* cache hits and misses of a mem case */
+    uint64_t cycles[BENCH_LIST_MAX * 8];
+} bench_case_t;
+
+typedef struct {
+    bench_case_t *bench;
+    int id;
+} bench_thread_t;
+
+static const char *s_que_name[QUE_TYPE_NONE] = {
+    "list",
+    "intrusive",
+    "ring",
+};
+
+static uint64_t __now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t __cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int __list_parse(bench_list_t *list, const char *str)
+{
+    char *end = NULL;
+
+    for (list->n = 0; list->n < BENCH_LIST_MAX; ) {
+        list->v[list->n++] = strtol(str, &end, 10);
+        if (end == str || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        if (*end == '\0') {
+            return 0;
+        }
+        str = end + 1;
+    }
+
+    return -1;
+}
+
+static void __mem_pair(bench_case_t *bench, int id)
+{
+    long i;
+    int j;
+    void *ptrs[BENCH_BATCH];
+
+    for (i = 0; i < bench->ops; i += BENCH_BATCH) {
+        for (j = 0; j < BENCH_BATCH; j++) {
+            ptrs[j] = bench->use_malloc ? malloc(bench->size) : mem_alloc(bench->size);
+            /* Touch it as a caller would */
+            *(volatile char *)ptrs[j] = 0;
+        }
+        for (j = BENCH_BATCH - 1; j >= 0; j--) {
+            if (bench->use_malloc) {
+                free(ptrs[j]);
+            } else {
+                mem_free(ptrs[j]);
+            }
+        }
+    }
+}
+
+static void __que_st(bench_case_t *bench, int id)
+{
+    long i;
+    int j;
+    void *element = NULL;
+
+    for (i = 0; i < bench->ops; i += BENCH_BATCH) {
+        for (j = 0; j < BENCH_BATCH; j++) {
+            que_put(bench->que, &bench->elems[j]);
+        }
+        for (j = 0; j < BENCH_BATCH; j++) {
+            que_get(bench->que, &element, 0);
+        }
+    }
+}
+
+/* The first n_producers threads put, the others get */
+static void __que_mpmc(bench_case_t *bench, int id)
+{
+    long i;
+    long total = bench->ops * bench->n_producers;
+    void *element = NULL;
+
+    if (id < bench->n_producers) {
+        for (i = id * bench->ops; i < (id + 1) * bench->ops; i++) {
+            while (que_put(bench->que, &bench->elems[i])) {
+                sched_yield();
+            }
+        }
+        return;
+    }
+
+    while (__atomic_load_n(&bench->got, __ATOMIC_RELAXED) < total) {
+        if (que_get(bench->que, &element, 0)) {
+            sched_yield();
+            continue;
+        }
+        __atomic_fetch_add(&bench->got, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void __que_remove(bench_case_t *bench, int id)
+{
+    long i;
+
+    for (i = 0; i < bench->ops; i++) {
+        que_remove(bench->que, &bench->elems[bench->elems[i].seq]);
+    }
+}
+
+static void *__bench_thread(void *arg)
+{
+    uint64_t start;
+    bench_thread_t *thread = arg;
+    bench_case_t *bench = thread->bench;
+
+    pthread_barrier_wait(&bench->start);
+    start = __cycles();
+    bench->func(bench, thread->id);
+    bench->cycles[thread->id] = __cycles() - start;
+
+    return NULL;
+}
+
+/* Run func on n_threads, each doing ops, return the wall ns */
+static uint64_t __bench_run(bench_case_t *bench)
+{
+    int i;
+    uint64_t start;
+    pthread_t threads[BENCH_LIST_MAX * 8];
+    bench_thread_t args[BENCH_LIST_MAX * 8];
+
+    assert(bench->n_threads <= sizeof(threads) / sizeof(threads[0]));
+    pthread_barrier_init(&bench->start, NULL, bench->n_threads + 1);
+    for (i = 0; i < bench->n_threads; i++) {
+        args[i].bench = bench;
+        args[i].id = i;
+        pthread_create(&threads[i], NULL, __bench_thread, &args[i]);
+    }
+
+    pthread_barrier_wait(&bench->start);
+    start = __now_ns();
+    for (i = 0; i < bench->n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    start = __now_ns() - start;
+    pthread_barrier_destroy(&bench->start);
+
+    return start;
+}
+
+static void __bench_report(const bench_conf_t *conf, const char *name, const char *impl,
+                           size_t size, const bench_case_t *bench, long ops, uint64_t ns)
+{
+    int i;
+    uint64_t cycles = 0;
+    size_t hits = bench->stat.alloc_hits + bench->stat.free_hits;
+    size_t calls = hits + bench->stat.alloc_misses + bench->stat.free_misses;
+
+    /* Every thread spends its cycles on the ops of the case */
+    for (i = 0; i < bench->n_threads; i++) {
+        cycles += bench->cycles[i];
+    }
+    fprintf(conf->out, "%s,%s,%zu,%d,%ld,%.0f,%.1f,", name, impl, size, bench->n_threads,
+            ops, ops * 1e9 / ns, (double)cycles / ops);
+    if (calls) {
+        fprintf(conf->out, "%.2f", hits * 100.0 / calls);
+    }
+    fprintf(conf->out, "\n");
+    fflush(conf->out);
+}
+
+static void __bench_mem(const bench_conf_t *conf)
+{
+    int s, t, m;
+    uint64_t ns;
+    bench_case_t bench;
+    mem_stat_t before, after;
+
+    for (s = 0; s < conf->sizes.n; s++) {
+        for (t = 0; t < conf->threads.n; t++) {
+            for (m = 0; m < 2; m++) {
+                memset(&bench, 0, sizeof(bench));
+                bench.func = __mem_pair;
+                bench.n_threads = conf->threads.v[t];
+                bench.ops = conf->ops / bench.n_threads / BENCH_BATCH * BENCH_BATCH;
+                bench.size = conf->sizes.v[s];
+                bench.use_malloc = m;
+                /* The threads fold their counters in as they exit */
+                mem_get_stat(&before);
+                ns = __bench_run(&bench);
+                mem_get_stat(&after);
+                if (!m) {
+                    bench.stat.alloc_hits = after.alloc_hits - before.alloc_hits;
+                    bench.stat.alloc_misses = after.alloc_misses - before.alloc_misses;
+                    bench.stat.free_hits = after.free_hits - before.free_hits;
+                    bench.stat.free_misses = after.free_misses - before.free_misses;
+                }
+                __bench_report(conf, "mem_pair", m ? "malloc" : "mem", bench.size, &bench,
+                               bench.ops * bench.n_threads, ns);
+            }
+        }
+    }
+}
+
+static void *__que_create(que_type_e type, long capacity)
+{
+    que_attr_t attr = {};
+    void *que = NULL;
+
+    attr.type = type;
+    attr.offset = offsetof(bench_elem_t, link);
+    attr.capacity = capacity;
+    if (que_create_ex(&attr, &que)) {
+        return NULL;
+    }
+
+    return que;
+}
+
+static void __bench_que(const bench_conf_t *conf)
+{
+    int t, type;
+    long i, j, tmp;
+    uint64_t ns;
+    bench_case_t bench;
+    unsigned int seed = 1;
+
+    for (type = 0; type < QUE_TYPE_NONE; type++) {
+        memset(&bench, 0, sizeof(bench));
+        bench.func = __que_st;
+        bench.n_threads = 1;
+        bench.ops = conf->ops / BENCH_BATCH * BENCH_BATCH;
+        bench.elems = calloc(BENCH_BATCH, sizeof(bench_elem_t));
+        bench.que = __que_create(type, BENCH_BATCH);
+        assert(bench.elems && bench.que);
+        ns = __bench_run(&bench);
+        /* A put and a get count as two ops */
+        __bench_report(conf, "que_st", s_que_name[type], 0, &bench, bench.ops * 2, ns);
+        que_delete(bench.que);
+        free(bench.elems);
+
+        /* One producer and one consumer first, then n of each */
+        for (t = -1; t < conf->threads.n; t++) {
+            memset(&bench, 0, sizeof(bench));
+            bench.func = __que_mpmc;
+            bench.n_producers = t < 0 ? 1 : conf->threads.v[t];
+            bench.n_threads = bench.n_producers * 2;
+            bench.ops = conf->ops / bench.n_producers;
+            bench.elems = calloc(bench.ops * bench.n_producers, sizeof(bench_elem_t));
+            bench.que = __que_create(type, bench.ops * bench.n_producers);
+            assert(bench.elems && bench.que);
+            ns = __bench_run(&bench);
+            __bench_report(conf, t < 0 ? "que_spsc" : "que_mpmc", s_que_name[type], 0, &bench,
+                           bench.ops * bench.n_producers * 2, ns);
+            que_delete(bench.que);
+            free(bench.elems);
+        }
+
+        /* Unlinked in O(1) from an intrusive list, a ring has to scan */
+        memset(&bench, 0, sizeof(bench));
+        bench.func = __que_remove;
+        bench.n_threads = 1;
+        bench.ops = conf->ops < BENCH_REMOVE_MAX ? conf->ops : BENCH_REMOVE_MAX;
+        bench.elems = calloc(bench.ops, sizeof(bench_elem_t));
+        bench.que = __que_create(type, bench.ops);
+        assert(bench.elems && bench.que);
+        for (i = 0; i < bench.ops; i++) {
+            bench.elems[i].seq = i;
+        }
+        for (i = bench.ops - 1; i > 0; i--) {
+            j = rand_r(&seed) % (i + 1);
+            tmp = bench.elems[i].seq;
+            bench.elems[i].seq = bench.elems[j].seq;
+            bench.elems[j].seq = tmp;
+        }
+        for (i = 0; i < bench.ops; i++) {
+            que_put(bench.que, &bench.elems[i]);
+        }
+        ns = __bench_run(&bench);
+        __bench_report(conf, "que_remove", s_que_name[type], 0, &bench, bench.ops, ns);
+        que_delete(bench.que);
+        free(bench.elems);
+    }
+}
+
+static void __usage(const char *name)
+{
+    printf("Usage: %s [options], a list is comma separated\n", name);
+    printf("  -s list  bytes of the mem cases, one per size class by default\n");
+    printf("  -t list  thread counts (default 1,2,4)\n");
+    printf("  -n num   ops of a case (default 1000000)\n");
+    printf("  -o file  write the rows to file instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    bench_conf_t conf = {};
+
+    /* The block header takes 8 bytes of each class */
+    __list_parse(&conf.sizes, "8,24,56,120,248,504,1016,2040,4088");
+    __list_parse(&conf.threads, "1,2,4");
+    conf.ops = 1000000;
+    conf.out = stdout;
+
+    while ((opt = getopt(argc, argv, "s:t:n:o:h")) != -1) {
+        switch (opt) {
+        case 's':
+            if (__list_parse(&conf.sizes, optarg)) {
+                __usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            if (__list_parse(&conf.threads, optarg)) {
+                __usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n': conf.ops = atol(optarg); break;
+        case 'o':
+            conf.out = fopen(optarg, "w");
+            if (conf.out == NULL) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            __usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    for (opt = 0; opt < conf.threads.n; opt++) {
+        if (conf.threads.v[opt] < 1 || conf.threads.v[opt] > BENCH_LIST_MAX * 4) {
+            __usage(argv[0]);
+            return 1;
+        }
+    }
+    if (conf.ops < BENCH_BATCH * BENCH_LIST_MAX * 8) {
+        __usage(argv[0]);
+        return 1;
+    }
+
+    fprintf(conf.out, "case,impl,size,threads,ops,ops_per_s,cycles_per_op,cache_hit_pct\n");
+    __bench_mem(&conf);
+    __bench_que(&conf);
+
+    if (conf.out != stdout) {
+        fclose(conf.out);
+    }
+
+    return 0;
+}